@@ -0,0 +1,228 @@
+#include "batch.h"
+#include "commands.h"
+#include "thread_pool.h"
+#include "common.h"
+#include "includes.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <mutex>
+
+using namespace std;
+
+extern string working_dir;
+
+#define CMD_PENDING     0
+#define CMD_OK          1
+#define CMD_FAILED      2
+#define CMD_SKIPPED     3
+
+struct batch_cmd
+{
+    int             line_no;
+    command_op      op;
+    int             state;
+    string          err_msg;
+    vector<string>  lines;
+    double          ms;
+    vector<size_t>  dependents;     // later commands waiting for this one
+    size_t          n_waiting;      // earlier commands this one still waits for
+    bool            dep_failed;
+
+    batch_cmd(): line_no(0), state(CMD_PENDING), ms(0), n_waiting(0), dep_failed(false) {}
+};
+
+struct batch_ctx
+{
+    vector<batch_cmd>  cmds;
+    work_pool         *pool;
+    work_group         grp;
+    mutex              lock;
+    size_t             next_print;  // results are printed in script order
+};
+
+static const char *state_names[] = {"pending", "ok", "failed", "skipped"};
+
+/* prints the results that are in and not preceded by a pending one; the
+ * caller holds ctx.lock
+ */
+static void results_print(batch_ctx &ctx)
+{
+    for(; ctx.next_print < ctx.cmds.size(); ++ctx.next_print)
+    {
+        batch_cmd &cmd = ctx.cmds[ctx.next_print];
+        if(cmd.state == CMD_PENDING)
+            break;
+
+        stringstream ss;
+        ss << "{\"line\": " << cmd.line_no << ", \"command\": \"" << json_escape(cmd.op.desc) << "\", \"status\": \""
+           << state_names[cmd.state] << "\", \"ms\": " << fixed << setprecision(3) << cmd.ms;
+        if(!cmd.err_msg.empty())
+            ss << ", \"message\": \"" << json_escape(cmd.err_msg) << "\"";
+        if(cmd.op.is_search)
+        {
+            ss << ", \"output\": [";
+            for(size_t i = 0; i < cmd.lines.size(); ++i)
+                ss << (i ? ", \"" : "\"") << json_escape(cmd.lines[i]) << "\"";
+            ss << "]";
+        }
+        ss << "}\n";
+        cout << ss.str() << flush;
+        vector<string>().swap(cmd.lines);
+    }
+}
+
+static void cmd_run(batch_ctx &ctx, size_t idx);
+
+/* records how a command went and starts the commands that were waiting
+ * only for it
+ */
+static void cmd_finish(batch_ctx &ctx, size_t idx, int state)
+{
+    lock_guard<mutex> lk(ctx.lock);
+    batch_cmd &cmd = ctx.cmds[idx];
+    cmd.state = state;
+    for(size_t dep_idx : cmd.dependents)
+    {
+        batch_cmd &dep = ctx.cmds[dep_idx];
+        if(state != CMD_OK && !dep.dep_failed)
+        {
+            dep.dep_failed = true;
+            dep.err_msg = "waits for line " + to_string(cmd.line_no) + ", which " +
+                          (state == CMD_SKIPPED ? "was skipped" : "failed");
+        }
+        if(0 == --dep.n_waiting)
+            ctx.pool->submit(ctx.grp, [&ctx, dep_idx] { cmd_run(ctx, dep_idx); });
+    }
+    results_print(ctx);
+}
+
+static void cmd_run(batch_ctx &ctx, size_t idx)
+{
+    batch_cmd &cmd = ctx.cmds[idx];
+    auto start = chrono::steady_clock::now();
+
+    int state = CMD_SKIPPED;
+    if(!cmd.dep_failed)
+    {
+        op_ctl ctl;
+        if(SUCCESS == cmd.op.check(cmd.err_msg) && SUCCESS == cmd.op.fn(ctl, cmd.err_msg, cmd.lines))
+            state = CMD_OK;
+        else
+            state = CMD_FAILED;
+    }
+    cmd.ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    cmd_finish(ctx, idx, state);
+}
+
+/* goto as in command mode, it only changes what later lines are relative to */
+static int goto_apply(vector<string> &command, string &err_msg)
+{
+    if(command.size() != 2)
+    {
+        err_msg = "goto: (usage):- \"goto <directory_path>\"";
+        return FAILURE;
+    }
+    string dest_path = abs_path_get(command[1]);
+    if(!dir_exists(dest_path))
+    {
+        err_msg = command[1] + " doesn't exist!!";
+        return FAILURE;
+    }
+    if(dest_path[dest_path.length() - 1] != '/')
+        dest_path = dest_path + "/";
+    working_dir = dest_path;
+    return SUCCESS;
+}
+
+int batch_run(const string &script_path)
+{
+    ifstream file;
+    istream *in = &cin;
+    if(script_path != "-")
+    {
+        file.open(script_path);
+        if(!file.is_open())
+        {
+            cerr << "Failed to open " << script_path << " : " << strerror(errno) << "\n";
+            return BATCH_EXIT_USAGE;
+        }
+        in = &file;
+    }
+
+    /* every line is parsed and its paths resolved up front, in order */
+    batch_ctx ctx;
+    ctx.next_print = 0;
+    int goto_failed_line = 0;
+    string text;
+    for(int line_no = 1; getline(*in, text); ++line_no)
+    {
+        if(!text.empty() && text[text.length() - 1] == '\r')
+            text.erase(text.length() - 1);
+        vector<string> command = command_parse(text);
+        if(command.empty() || command[0][0] == '#')
+            continue;
+
+        ctx.cmds.emplace_back();
+        batch_cmd &cmd = ctx.cmds.back();
+        cmd.line_no = line_no;
+        cmd.op.desc = job_desc_get(command);
+        if(goto_failed_line)
+        {
+            cmd.state = CMD_SKIPPED;
+            cmd.err_msg = "goto on line " + to_string(goto_failed_line) + " failed";
+        }
+        else if(command[0] == "goto")
+        {
+            cmd.state = (SUCCESS == goto_apply(command, cmd.err_msg)) ? CMD_OK : CMD_FAILED;
+            if(cmd.state == CMD_FAILED)
+                goto_failed_line = line_no;
+        }
+        else if(FAILURE == command_prepare(command, cmd.op, cmd.err_msg))
+        {
+            cmd.state = CMD_FAILED;
+        }
+    }
+    if(in->bad())
+    {
+        cerr << "Failed to read " << script_path << "\n";
+        return BATCH_EXIT_USAGE;
+    }
+
+    /* a command waits for every earlier one it shares a path with */
+    for(size_t i = 0; i < ctx.cmds.size(); ++i)
+    {
+        if(ctx.cmds[i].state != CMD_PENDING)
+            continue;
+        for(size_t j = 0; j < i; ++j)
+        {
+            if(ctx.cmds[j].state == CMD_PENDING && command_ops_conflict(ctx.cmds[j].op, ctx.cmds[i].op))
+            {
+                ctx.cmds[j].dependents.pb(i);
+                ++ctx.cmds[i].n_waiting;
+            }
+        }
+    }
+
+    auto start = chrono::steady_clock::now();
+    work_pool pool(max(BATCH_MIN_WORKERS, (int) thread::hardware_concurrency()));
+    ctx.pool = &pool;
+    {
+        lock_guard<mutex> lk(ctx.lock);
+        for(size_t i = 0; i < ctx.cmds.size(); ++i)
+            if(ctx.cmds[i].state == CMD_PENDING && !ctx.cmds[i].n_waiting)
+                pool.submit(ctx.grp, [&ctx, i] { cmd_run(ctx, i); });
+        results_print(ctx);
+    }
+    pool.wait(ctx.grp);
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+    size_t n_state[4] = {0, 0, 0, 0};
+    for(auto &cmd : ctx.cmds)
+        ++n_state[cmd.state];
+    cout << "{\"summary\": true, \"commands\": " << ctx.cmds.size() << ", \"ok\": " << n_state[CMD_OK]
+         << ", \"failed\": " << n_state[CMD_FAILED] << ", \"skipped\": " << n_state[CMD_SKIPPED]
+         << ", \"ms\": " << fixed << setprecision(3) << ms << "}\n" << flush;
+    return (n_state[CMD_OK] == ctx.cmds.size()) ? BATCH_EXIT_OK : BATCH_EXIT_FAILED;
+}
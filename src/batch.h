@@ -0,0 +1,23 @@
+#ifndef _BATCH_H_
+#define _BATCH_H_
+
+#include <string>
+
+#define BATCH_EXIT_OK       0
+#define BATCH_EXIT_FAILED   1       // a command failed or was skipped
+#define BATCH_EXIT_USAGE    2       // the script could not be read
+
+#define BATCH_MIN_WORKERS   4       // commands mostly wait on the disk, run a few at once even on one core
+
+/* runs the commands of script_path ("-" for stdin) without a terminal, one
+ * per line as typed in command mode; empty lines and lines starting with
+ * '#' are skipped, "goto <dir>" changes the directory the later lines are
+ * relative to. A command waits for the earlier ones whose paths overlap
+ * its own and is skipped if one of them failed; the others run side by
+ * side. Each command gets a JSON line on stdout, in script order, with
+ * its status, time and output, and a summary line ends the run.
+ * Returns one of the BATCH_EXIT_* codes.
+ */
+int batch_run(const std::string &script_path);
+
+#endif
@@ -0,0 +1,601 @@
+#include "normal_mode.h"
+#include "dir_scan.h"
+#include "file_ops.h"
+#include "name_index.h"
+#include "search_walk.h"
+#include "snapshot.h"
+#include "thread_pool.h"
+#include "common.h"
+#include "includes.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fcntl.h>
+#include <functional>
+#include <linux/perf_event.h>
+#include <random>
+#include <set>
+#include <sys/syscall.h>
+#include <vector>
+
+using namespace std;
+
+/* reproducible benchmarks of the explorer's hot paths over generated trees:
+ *   bhavi-bench [--quick] [--iterations <n>] [--dir <scratch_dir>] [--json <results_file>] [<name_prefix>...]
+ * The trees are generated with a fixed seed under a fresh directory in the
+ * scratch directory (/tmp by default) and removed at the end:
+ *   flat    one directory of 1M empty files
+ *   deep    a chain of 1000 directories holding 4 files each
+ *   mixed   200 directories of 100 files, mostly small, a few up to 1 MB
+ *   sparse  4 files of 1 GB with three 64 KB extents of data each
+ * --quick shrinks every tree about 20 times. Every benchmark runs once
+ * untimed, then <n> timed iterations (10 by default); the median and p99
+ * wall time, the median number of syscalls of an iteration and its median
+ * read/write call counts and bytes from /proc/self/io are written to the
+ * results file (bench-results.json by default) as JSON. The syscalls are
+ * counted on every thread with perf_event_open on the raw_syscalls:sys_enter
+ * tracepoint, which needs tracefs mounted and perf_event_paranoid <= 1 (or
+ * CAP_PERFMON); without them the count is reported as null. What the probes
+ * themselves cost is measured once and taken off every count.
+ */
+
+typedef chrono::steady_clock bench_clock;
+
+extern string           working_dir;
+extern struct winsize   w;
+
+struct io_counts
+{
+    int64_t   syscalls;     // -1 when they can't be counted
+    uint64_t  read_calls;
+    uint64_t  write_calls;
+    uint64_t  read_bytes;
+    uint64_t  write_bytes;
+};
+
+struct bench_result
+{
+    string  name;
+    int     iterations;
+    double  median_ms;
+    double  p99_ms;
+    double  min_ms;
+    double  max_ms;
+    io_counts io;
+};
+
+struct bench_case
+{
+    string          name;
+    function<void()> setup;     // untimed, before every iteration
+    function<void()> run;
+    function<void()> teardown;  // untimed, after every iteration
+};
+
+struct tree_sizes
+{
+    int  flat_files;
+    int  deep_levels;
+    int  mixed_dirs;
+    int  mixed_files;
+    int  sparse_files;
+    long sparse_size;
+};
+
+/* one raw_syscalls:sys_enter counter per thread; inherit covers the threads
+ * they start later
+ */
+static vector<int>  syscall_fds;
+static set<string>  syscall_tids;
+static int          syscall_tp_id = FAILURE;
+static string       syscall_err;
+
+static int tracepoint_id_get(string &err_msg)
+{
+    const char *paths[] = {"/sys/kernel/tracing/events/raw_syscalls/sys_enter/id",
+                           "/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id"};
+    for(const char *path : paths)
+    {
+        ifstream in(path);
+        int id;
+        if(in >> id)
+            return id;
+    }
+    err_msg = "no raw_syscalls:sys_enter tracepoint, is tracefs mounted?";
+    return FAILURE;
+}
+
+/* opens a counter on every thread that doesn't have one yet; the pools start
+ * their workers lazily, so this is redone before every benchmark
+ */
+static void syscall_counters_open()
+{
+    if(!syscall_err.empty())
+        return;
+    if(syscall_tp_id == FAILURE && FAILURE == (syscall_tp_id = tracepoint_id_get(syscall_err)))
+    {
+        cerr << "syscalls not counted, " << syscall_err << "\n";
+        return;
+    }
+
+    DIR *dir = opendir("/proc/self/task");
+    if(!dir)
+    {
+        syscall_err = string("/proc/self/task: ") + strerror(errno);
+        cerr << "syscalls not counted, " << syscall_err << "\n";
+        return;
+    }
+    struct dirent *ent;
+    while(syscall_err.empty() && (ent = readdir(dir)))
+    {
+        if(ent->d_name[0] == '.' || syscall_tids.count(ent->d_name))
+            continue;
+
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_TRACEPOINT;
+        attr.size = sizeof(attr);
+        attr.config = syscall_tp_id;
+        attr.inherit = 1;
+        int fd = syscall(SYS_perf_event_open, &attr, atoi(ent->d_name), -1, -1, PERF_FLAG_FD_CLOEXEC);
+        if(fd == FAILURE)
+        {
+            if(errno == ESRCH)      // the thread is gone
+                continue;
+            syscall_err = string("perf_event_open: ") + strerror(errno);
+            break;
+        }
+        syscall_fds.pb(fd);
+        syscall_tids.insert(ent->d_name);
+    }
+    closedir(dir);
+
+    if(!syscall_err.empty())
+    {
+        for(int fd : syscall_fds)
+            close(fd);
+        syscall_fds.clear();
+        cerr << "syscalls not counted, " << syscall_err << "\n";
+    }
+}
+
+static int64_t syscalls_get()
+{
+    if(!syscall_err.empty())
+        return -1;
+    int64_t total = 0;
+    for(int fd : syscall_fds)
+    {
+        uint64_t count;
+        if(read(fd, &count, sizeof(count)) != sizeof(count))
+            return -1;
+        total += count;
+    }
+    return total;
+}
+
+static io_counts io_counts_get()
+{
+    io_counts io = {};
+    io.syscalls = syscalls_get();
+    ifstream proc_io("/proc/self/io");
+    string key;
+    uint64_t value;
+    while(proc_io >> key >> value)
+    {
+        if(key == "syscr:")
+            io.read_calls = value;
+        else if(key == "syscw:")
+            io.write_calls = value;
+        else if(key == "rchar:")
+            io.read_bytes = value;
+        else if(key == "wchar:")
+            io.write_bytes = value;
+    }
+    return io;
+}
+
+/* what a pair of probes adds to a count, it grows with the threads counted */
+static io_counts probe_cost;
+
+static uint64_t count_delta(uint64_t before, uint64_t after, uint64_t cost)
+{
+    return (after - before > cost) ? after - before - cost : 0;
+}
+
+static io_counts io_counts_delta(const io_counts &before, const io_counts &after)
+{
+    io_counts io;
+    io.syscalls = (before.syscalls < 0 || after.syscalls < 0) ? -1 :
+                  (int64_t) count_delta(before.syscalls, after.syscalls, probe_cost.syscalls);
+    io.read_calls = count_delta(before.read_calls, after.read_calls, probe_cost.read_calls);
+    io.write_calls = count_delta(before.write_calls, after.write_calls, probe_cost.write_calls);
+    io.read_bytes = count_delta(before.read_bytes, after.read_bytes, probe_cost.read_bytes);
+    io.write_bytes = count_delta(before.write_bytes, after.write_bytes, probe_cost.write_bytes);
+    return io;
+}
+
+/* counts the threads there are now; back to back probes only see each other */
+static void probes_calibrate()
+{
+    syscall_counters_open();
+    io_counts first = io_counts_get(), second = io_counts_get();
+    probe_cost = {};
+    probe_cost = io_counts_delta(first, second);
+}
+
+template <typename T>
+static T median_get(vector<T> v)
+{
+    sort(v.begin(), v.end());
+    return v[v.size() / 2];
+}
+
+/* nearest-rank percentile */
+static double percentile_get(vector<double> v, double pct)
+{
+    sort(v.begin(), v.end());
+    size_t rank = (size_t) ceil(pct / 100.0 * v.size());
+    return v[max((size_t) 1, rank) - 1];
+}
+
+static bench_result bench_run(const bench_case &bc, int iterations)
+{
+    vector<double> times;
+    vector<int64_t> syscalls;
+    vector<uint64_t> read_calls, write_calls, read_bytes, write_bytes;
+
+    for(int i = -1; i < iterations; ++i)       // the first round warms the caches up
+    {
+        if(bc.setup)
+            bc.setup();
+
+        io_counts before = io_counts_get();
+        auto start = bench_clock::now();
+        bc.run();
+        double ms = chrono::duration<double, milli>(bench_clock::now() - start).count();
+        io_counts after = io_counts_get();
+
+        if(bc.teardown)
+            bc.teardown();
+        if(i < 0)
+        {
+            probes_calibrate();     // the warm-up may have started threads
+            continue;
+        }
+
+        io_counts io = io_counts_delta(before, after);
+        times.pb(ms);
+        syscalls.pb(io.syscalls);
+        read_calls.pb(io.read_calls);
+        write_calls.pb(io.write_calls);
+        read_bytes.pb(io.read_bytes);
+        write_bytes.pb(io.write_bytes);
+    }
+
+    bench_result res;
+    res.name = bc.name;
+    res.iterations = iterations;
+    res.median_ms = median_get(times);
+    res.p99_ms = percentile_get(times, 99);
+    res.min_ms = *min_element(times.begin(), times.end());
+    res.max_ms = *max_element(times.begin(), times.end());
+    res.io.syscalls = (*min_element(syscalls.begin(), syscalls.end()) < 0) ? -1 : median_get(syscalls);
+    res.io.read_calls = median_get(read_calls);
+    res.io.write_calls = median_get(write_calls);
+    res.io.read_bytes = median_get(read_bytes);
+    res.io.write_bytes = median_get(write_bytes);
+    return res;
+}
+
+static void bench_fail(const string &what, const string &err_msg)
+{
+    cerr << what << ": " << err_msg << "\n";
+    exit(1);
+}
+
+/* deterministic file contents; the workers creating files all ask for it */
+static const vector<char>& data_block_get()
+{
+    static const vector<char> block = []
+    {
+        mt19937 rng(7);
+        vector<char> data(1024 * 1024);
+        for(auto &c : data)
+            c = (char) rng();
+        return data;
+    }();
+    return block;
+}
+
+static void file_create(const string &path, size_t size)
+{
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP);
+    if(FAILURE == fd)
+        bench_fail("create " + path, strerror(errno));
+
+    const vector<char> &block = data_block_get();
+    while(size)
+    {
+        size_t n = min(size, block.size());
+        if(write(fd, block.data(), n) != (ssize_t) n)
+            bench_fail("write " + path, strerror(errno));
+        size -= n;
+    }
+    close(fd);
+}
+
+static void dir_create(const string &path)
+{
+    if(FAILURE == mkdir(path.c_str(), S_IRWXU | S_IRGRP | S_IXGRP))
+        bench_fail("mkdir " + path, strerror(errno));
+}
+
+static void flat_tree_create(const string &path, int n_files)
+{
+    dir_create(path);
+
+    /* creating a million files one after the other takes a while, spread it */
+    work_pool &pool = pool_get();
+    work_group grp;
+    const int chunk = 4096;
+    for(int start = 0; start < n_files; start += chunk)
+    {
+        int end = min(start + chunk, n_files);
+        pool.submit(grp, [path, start, end]
+        {
+            for(int i = start; i < end; ++i)
+                file_create(path + "/file_" + to_string(i), 0);
+        });
+    }
+    pool.wait(grp);
+}
+
+static void deep_tree_create(const string &path, int levels)
+{
+    string dir_path = path;
+    dir_create(dir_path);
+    for(int i = 0; i < levels; ++i)
+    {
+        for(int f = 0; f < 4; ++f)
+            file_create(dir_path + "/f" + to_string(f), 100 * f);
+        dir_path += "/d";
+        dir_create(dir_path);
+    }
+}
+
+/* sizes: 80% below 4 KB, 19% 4-32 KB, 1% 256 KB-1 MB */
+static void mixed_tree_create(const string &path, int n_dirs, int n_files)
+{
+    mt19937 rng(42);
+    dir_create(path);
+    for(int d = 0; d < n_dirs; ++d)
+    {
+        string dir_path = path + "/dir_" + to_string(d);
+        dir_create(dir_path);
+        for(int f = 0; f < n_files; ++f)
+        {
+            unsigned int pick = rng() % 100;
+            size_t size;
+            if(pick < 80)
+                size = rng() % 4096;
+            else if(pick < 99)
+                size = 4096 + rng() % (28 * 1024);
+            else
+                size = 256 * 1024 + rng() % (768 * 1024);
+            file_create(dir_path + "/f_" + to_string(d) + "_" + to_string(f) + ".dat", size);
+        }
+    }
+}
+
+static void sparse_tree_create(const string &path, int n_files, long size)
+{
+    const vector<char> &block = data_block_get();
+    const long extent = 64 * 1024;
+
+    dir_create(path);
+    for(int i = 0; i < n_files; ++i)
+    {
+        string file_path = path + "/sparse_" + to_string(i);
+        int fd = open(file_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+        if(FAILURE == fd || FAILURE == ftruncate(fd, size))
+            bench_fail("create " + file_path, strerror(errno));
+        for(long off : {0L, size / 2, size - extent})
+        {
+            if(pwrite(fd, block.data(), extent, off) != extent)
+                bench_fail("write " + file_path, strerror(errno));
+        }
+        close(fd);
+    }
+}
+
+static void tree_remove(const string &path)
+{
+    string err_msg;
+    if(SUCCESS == access(path.c_str(), F_OK) && FAILURE == tree_delete(path, err_msg))
+        bench_fail("delete " + path, err_msg);
+}
+
+/* the listing path used before dir_scan: scandir + alphasort + stat by absolute path */
+static int scandir_listing(const string &dir_path)
+{
+    struct dirent **dir_entry_arr;
+    int n = scandir(dir_path.c_str(), &dir_entry_arr, NULL, alphasort);
+    if(n == FAILURE)
+        return FAILURE;
+
+    for(int i = 0; i < n; ++i)
+    {
+        struct stat dir_entry_stat;
+        stat((dir_path + dir_entry_arr[i]->d_name).c_str(), &dir_entry_stat);
+        free(dir_entry_arr[i]);
+    }
+    free(dir_entry_arr);
+    return n;
+}
+
+static void search_walk_run(const string &root, const string &pattern, int kind)
+{
+    string err_msg;
+    if(FAILURE == search_walk_start(root, pattern, kind, err_msg))
+        bench_fail("search " + pattern, err_msg);
+
+    vector<search_hit> hits;
+    while(search_walk_drain(hits))
+        search_walk_wait(100);
+    search_walk_cancel();
+}
+
+static int results_write(const string &json_path, const tree_sizes &sizes, const vector<bench_result> &results)
+{
+    ofstream out(json_path.c_str(), ios::out | ios::trunc);
+    out << "{\n  \"trees\": {\"flat_files\": " << sizes.flat_files << ", \"deep_levels\": " << sizes.deep_levels
+        << ", \"mixed_dirs\": " << sizes.mixed_dirs << ", \"mixed_files_per_dir\": " << sizes.mixed_files
+        << ", \"sparse_files\": " << sizes.sparse_files << ", \"sparse_size\": " << sizes.sparse_size << "},\n"
+        << "  \"workers\": " << pool_get().size() << ",\n  \"benchmarks\": [\n";
+    for(size_t i = 0; i < results.size(); ++i)
+    {
+        const bench_result &r = results[i];
+        out << "    {\"name\": \"" << json_escape(r.name) << "\", \"iterations\": " << r.iterations
+            << ", \"median_ms\": " << r.median_ms << ", \"p99_ms\": " << r.p99_ms
+            << ", \"min_ms\": " << r.min_ms << ", \"max_ms\": " << r.max_ms
+            << ", \"syscalls\": " << (r.io.syscalls < 0 ? "null" : to_string(r.io.syscalls))
+            << ", \"read_calls\": " << r.io.read_calls << ", \"write_calls\": " << r.io.write_calls
+            << ", \"read_bytes\": " << r.io.read_bytes << ", \"write_bytes\": " << r.io.write_bytes << "}"
+            << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+    out.close();
+    return out.fail() ? FAILURE : SUCCESS;
+}
+
+int main(int argc, char* argv[])
+{
+    tree_sizes sizes = {1000000, 1000, 200, 100, 4, 1L << 30};
+    int iterations = 10;
+    string scratch_path = "/tmp", json_path = "bench-results.json";
+    vector<string> selected;
+
+    for(int i = 1; i < argc; ++i)
+    {
+        string arg = argv[i];
+        if(arg == "--quick")
+            sizes = {50000, 200, 20, 50, 2, 64L << 20};
+        else if(arg == "--iterations" && i + 1 < argc)
+            iterations = max(1, atoi(argv[++i]));
+        else if(arg == "--dir" && i + 1 < argc)
+            scratch_path = argv[++i];
+        else if(arg == "--json" && i + 1 < argc)
+            json_path = argv[++i];
+        else if(arg[0] == '-')
+        {
+            cerr << "usage: bhavi-bench [--quick] [--iterations <n>] [--dir <scratch_dir>] "
+                    "[--json <results_file>] [<name_prefix>...]\n";
+            return 1;
+        }
+        else
+            selected.pb(arg);
+    }
+
+    string tmpl_str = scratch_path + "/bhavi-bench-XXXXXX";
+    vector<char> tmpl(tmpl_str.begin(), tmpl_str.end());
+    tmpl.pb('\0');
+    if(!mkdtemp(tmpl.data()))
+        bench_fail("mkdtemp " + tmpl_str, strerror(errno));
+    string root = tmpl.data();
+    string trees = root + "/trees", work = root + "/work";
+
+    /* the filename index goes with the trees */
+    setenv("XDG_CACHE_HOME", (root + "/cache").c_str(), 1);
+
+    auto gen_start = bench_clock::now();
+    dir_create(trees);
+    dir_create(work);
+    flat_tree_create(trees + "/flat", sizes.flat_files);
+    deep_tree_create(trees + "/deep", sizes.deep_levels);
+    mixed_tree_create(trees + "/mixed", sizes.mixed_dirs, sizes.mixed_files);
+    sparse_tree_create(trees + "/sparse", sizes.sparse_files, sizes.sparse_size);
+    sync();
+    cerr << "generated the trees in " << root << " in "
+         << chrono::duration<double>(bench_clock::now() - gen_start).count() << " s\n";
+
+    /* the listing formatter wraps lines at the terminal width */
+    w.ws_col = 160;
+    w.ws_row = 50;
+
+    string flat_dir = trees + "/flat/", snap_prev = root + "/prev.snap";
+    vector<scan_entry> entries;
+    string err_msg;
+    snapshot_stats stats;
+    auto must = [](int ret, const string &what, const string &err_msg)
+    {
+        if(FAILURE == ret)
+            bench_fail(what, err_msg);
+    };
+
+    vector<bench_case> cases =
+    {
+        {"listing.scandir_stat", NULL, [&] { scandir_listing(flat_dir); }, NULL},
+        {"listing.dir_scan", NULL, [&] { dir_scan(flat_dir, entries, SCAN_DOTS | SCAN_POOL); }, NULL},
+        {"listing.content_list_create", [&] { working_dir = flat_dir; }, [&] { content_list_create(); }, NULL},
+        {"search.index", NULL, [&]
+        {
+            vector<string> paths;
+            must(name_index_search(trees + "/", INDEX_EXACT, "f_7_7.dat", paths, err_msg), "search.index", err_msg);
+        }, NULL},
+        {"search.glob", NULL, [&] { search_walk_run(trees + "/", "*_7.dat", SEARCH_GLOB); }, NULL},
+        {"search.regex", NULL, [&] { search_walk_run(trees + "/", "^f_1[0-9]_.*\\.dat$", SEARCH_REGEX); }, NULL},
+        {"copy.mixed", NULL, [&] { must(tree_copy(trees + "/mixed", work, err_msg), "copy.mixed", err_msg); },
+         [&] { tree_remove(work + "/mixed"); }},
+        {"copy.sparse", NULL, [&] { must(tree_copy(trees + "/sparse", work, err_msg), "copy.sparse", err_msg); },
+         [&] { tree_remove(work + "/sparse"); }},
+        {"move.mixed", NULL, [&] { must(path_move(trees + "/mixed", work, err_msg), "move.mixed", err_msg); },
+         [&] { must(path_move(work + "/mixed", trees, err_msg), "move.mixed", err_msg); }},
+        {"delete_dir.mixed", [&] { must(tree_copy(trees + "/mixed", work, err_msg), "delete_dir.mixed", err_msg); },
+         [&] { must(tree_delete(work + "/mixed", err_msg), "delete_dir.mixed", err_msg); }, NULL},
+        {"delete_dir.deep", [&] { must(tree_copy(trees + "/deep", work, err_msg), "delete_dir.deep", err_msg); },
+         [&] { must(tree_delete(work + "/deep", err_msg), "delete_dir.deep", err_msg); }, NULL},
+        {"snapshot.text", NULL, [&]
+        {
+            must(snapshot_write(trees, work + "/snap.txt", SNAPSHOT_TEXT, "", stats, err_msg), "snapshot.text", err_msg);
+        }, NULL},
+        {"snapshot.binary", NULL, [&]
+        {
+            must(snapshot_write(trees, snap_prev, SNAPSHOT_BINARY, "", stats, err_msg), "snapshot.binary", err_msg);
+        }, NULL},
+        {"snapshot.incremental", NULL, [&]
+        {
+            must(snapshot_write(trees, work + "/snap.bin", SNAPSHOT_BINARY, snap_prev, stats, err_msg),
+                 "snapshot.incremental", err_msg);
+        }, NULL},
+    };
+
+    vector<bench_result> results;
+    for(auto &bc : cases)
+    {
+        bool wanted = selected.empty();
+        for(auto &prefix : selected)
+            wanted = wanted || bc.name.compare(0, prefix.length(), prefix) == 0;
+        if(!wanted)
+            continue;
+
+        /* the incremental snapshot needs a previous one */
+        if(bc.name == "snapshot.incremental" && FAILURE == access(snap_prev.c_str(), F_OK))
+            must(snapshot_write(trees, snap_prev, SNAPSHOT_BINARY, "", stats, err_msg), "snapshot", err_msg);
+
+        bench_result res = bench_run(bc, iterations);
+        results.pb(res);
+        printf("%-30s median %10.2f ms   p99 %10.2f ms   syscalls %8s   reads %8lu   writes %8lu\n",
+               res.name.c_str(), res.median_ms, res.p99_ms,
+               res.io.syscalls < 0 ? "n/a" : to_string(res.io.syscalls).c_str(),
+               (unsigned long) res.io.read_calls, (unsigned long) res.io.write_calls);
+        fflush(stdout);
+    }
+
+    tree_remove(root);
+    if(FAILURE == results_write(json_path, sizes, results))
+        bench_fail("write " + json_path, strerror(errno));
+    cerr << "results written to " << json_path << "\n";
+    return 0;
+}
@@ -1,8 +1,20 @@
 #include "normal_mode.h"
 #include "command_mode.h"
 #include "common.h"
+#include "file_ops.h"
+#include "jobs.h"
+#include "name_cache.h"
+#include "name_index.h"
+#include "search_walk.h"
+#include "snapshot.h"
+#include "stats.h"
+#include "render.h"
 #include "includes.h"
 
+#include <iomanip>         // setw, setprecision
+#include <mutex>
+#include <poll.h>
+
 using namespace std;
 
 extern int                cursor_c_pos;
@@ -10,7 +22,7 @@ extern int                cursor_left_limit;
 extern int                cursor_right_limit;
 extern int                current_mode;
 extern struct winsize     w;
-extern list<dir_content>  content_list;
+extern content_store      content_list;
 extern stack<string>      fwd_stack;
 extern string             working_dir;
 extern string             root_dir;
@@ -18,15 +30,12 @@ extern bool               is_search_content;
 extern stack<string>      bwd_stack;
 extern stack<string>      fwd_stack;
 
-static string search_str;
-static string snapshot_folder_path;
-static string dumpfile_path;
-static string dest_root;
-int    src_dir_pos;
-
 static bool is_status_on;
 
-constexpr int ftw_max_fd = 100;
+/* groups found by a dupes job, waiting for the interface to show them */
+static mutex               dupes_done_lock;
+static vector<dupe_group>  dupes_done;
+static bool                is_dupes_done;
 
 void enter_command_mode()
 {
@@ -69,8 +78,7 @@ void enter_command_mode()
                         cursor_init();
                         from_cursor_line_clear();
                         cmd.erase(cursor_c_pos - cursor_left_limit, 1);
-                        cout << cmd.substr(cursor_c_pos - cursor_left_limit);
-                        cout.flush();
+                        term_write(cmd.substr(cursor_c_pos - cursor_left_limit));
                         cursor_init();
                     }
                     break;
@@ -97,8 +105,7 @@ void enter_command_mode()
 
                 default:
                     cmd.insert(cursor_c_pos - cursor_left_limit, 1, ch);
-                    cout << cmd.substr(cursor_c_pos - cursor_left_limit);
-                    cout.flush();
+                    term_write(cmd.substr(cursor_c_pos - cursor_left_limit));
                     ++cursor_c_pos;
                     cursor_init();
                     ++cursor_right_limit;
@@ -111,254 +118,282 @@ void enter_command_mode()
         if(cmd.empty())
             continue;
 
-        string part;
-        vector<string> command;
+        vector<string> command = command_parse(cmd);
+        if(command.empty())
+            continue;
 
-        for(unsigned int i = 0; i < cmd.length(); ++i)
+        if(command[0] == "goto")
         {
-            if(cmd[i] == ' ')
-            {
-                if(!part.empty())
-                {
-                    command.pb(part);
-                    part = "";
-                }
-            }
-            else if(cmd[i] == '\\' && (i < cmd.length() - 1) && cmd[i+1] == ' ')
+            if(FAILURE == command_size_check(command, 2, 2, "goto: (usage):- \"goto <directory_path>\""))
+                continue;
+
+            string dest_path = abs_path_get(command[1]);
+            if(!dir_exists(dest_path))
             {
-                part += ' ';
-                ++i;
+                status_print(command[1] + " doesn't exist!!");
+                continue;
             }
-            else
+            if(dest_path[dest_path.length() - 1] != '/')
+                dest_path = dest_path + "/";
+
+            if(dest_path == working_dir)
             {
-                part += cmd[i];
+                status_print("Current directory and Destination directory are the same!!");
+                continue;
             }
-        }
-        if(!part.empty())
-            command.pb(part);
-
-        if(command.empty())
-            continue;
+            stack_clear(fwd_stack);
+            bwd_stack.push(working_dir);
 
-        if(command[0] == "copy")
-        {
-            if(FAILURE == command_size_check(command, 3, INT_MAX, "copy: (usage):- \"copy <source_file/dir(s)>"
-                                                                  " <destination_directory>\""))
-                continue;
-            copy_command(command);
+            working_dir = dest_path;
+            display_refresh();
         }
-        else if(command[0] == "move")
+        else if(command[0] == "search")
         {
-            if(FAILURE == command_size_check(command, 3, INT_MAX, "move: (usage):- \"move <source_file/dir(s)>"
-                                                                  " <destination_directory>\""))
+            string usage = "search: (usage):- \"search <name> | <glob> | -r <regex>\"";
+            if(FAILURE == command_size_check(command, 2, 3, usage))
                 continue;
-            move_command(command);
-        }
-        else if(command[0] == "rename")
-        {
-            if(FAILURE == command_size_check(command, 3, 3, "rename: (usage):- \"rename <source_file/dir>"
-                                                             " <destination_file/dir>\""))
+            if(command.size() == 3 && command[1] != "-r")
+            {
+                status_print(usage);
                 continue;
-            
-            string old_path = abs_path_get(command[1]);
-            string new_path = abs_path_get(command[2]);
-            if(is_directory(old_path))
+            }
+            search_stop();
+
+            string query = command.back();
+            vector<string> paths;
+            string err_msg;
+            int match = index_match_get(query);
+            if(command.size() == 2 && match != FAILURE)
             {
-                if(!dir_exists(old_path))
-                {
-                    status_print(command[1] + " doesn't exist!!");
-                    continue;
-                }
-                if(dir_exists(new_path))
+                /* name, prefix* and *part* are answered from the filename index */
+                if(FAILURE == name_index_search(working_dir, match, query, paths, err_msg))
                 {
-                    status_print(command[2] + " already exists!!");
+                    status_print(err_msg);
                     continue;
                 }
+                listing_discard();
+                for(auto &path : paths)
+                    search_result_add(path);
             }
             else
             {
-                if(!file_exists(old_path))
-                {
-                    status_print(command[1] + " doesn't exist!!");
-                    continue;
-                }
-                if(file_exists(new_path))
-                {
-                    status_print(command[2] + " already exists!!");
+                /* any other glob or a regex needs a walk, its matches stream in */
+                int kind = (command.size() == 3) ? SEARCH_REGEX : SEARCH_GLOB;
+                if(FAILURE == search_walk_show(working_dir, query, kind))
                     continue;
-                }
-            }
-            if(FAILURE == rename(old_path.c_str(), new_path.c_str()))
-            {
-                status_print("rename failed!! errno: " + to_string(errno));
             }
-            else
+            if(content_list.empty())
             {
-                display_refresh();
+                status_print("No match found!!");
+                continue;
             }
+            is_search_content = true;
+            stack_clear(fwd_stack);
+            break;
         }
-        else if(command[0] == "create_file")
+        else if(command[0] == "grep")
         {
-            if(FAILURE == command_size_check(command, 3, 3, "create_file: (usage):- \"create_file <new_file>"
-                                                             " <destination_dir>\""))
+            if(FAILURE == command_size_check(command, 2, 3, "grep: (usage):- \"grep <text> [dir]\""))
                 continue;
 
-            string dest_path = abs_path_get(command[2]);
-            if(dest_path[dest_path.length() - 1] != '/')
-                dest_path = dest_path + "/";
-
-            if(!dir_exists(dest_path))
+            string dir_arg = (command.size() == 3) ? command[2] : ".";
+            string dir_path = abs_path_get(dir_arg);
+            if(!dir_exists(dir_path))
             {
-                status_print(command[2] + " doesn't exists!!");
+                status_print(dir_arg + " doesn't exist!!");
                 continue;
             }
-            dest_path += command[1];
-            if(file_exists(dest_path))
-            {
-                status_print(command[1] + " already exists at " + command[2]);
+            search_stop();
+            if(FAILURE == search_walk_show(dir_path, command[1], SEARCH_CONTENT))
                 continue;
-            }
-
-            int fd = open(dest_path.c_str(), O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
-            if(FAILURE == fd)
-            {
-                status_print( "open failed!! errno: " + to_string(errno));
-            }
-            else
+            if(content_list.empty())
             {
-                close(fd);
-                display_refresh();
+                status_print("No match found!!");
+                continue;
             }
+            is_search_content = true;
+            stack_clear(fwd_stack);
+            break;
         }
-        else if(command[0] == "create_dir")
+        else if(command[0] == "snapdiff")
         {
-            if(FAILURE == command_size_check(command, 3, 3, "create_dir: (usage):- \"create_dir <new_dir>"
-                                                             " <destination_dir>\""))
+            if(FAILURE == command_size_check(command, 3, 4, "snapdiff: (usage):- \"snapdiff <old_dumpfile> <new_dumpfile> [folder]\""))
                 continue;
-
-            string dest_path = abs_path_get(command[2]);
-            if(dest_path[dest_path.length() - 1] != '/')
-                dest_path = dest_path + "/";
-
-            if(!dir_exists(dest_path))
+            search_stop();
+
+            /* results are opened relative to the folder the snapshots were taken of */
+            string folder_path = abs_path_get(command.size() == 4 ? command[3] : ".");
+            if(folder_path[folder_path.length() - 1] == '/')
+                folder_path.erase(folder_path.length() - 1);
+
+            listing_discard();
+            unsigned long n_diffs = 0;
+            string err_msg;
+            int ret = snapshot_diff(abs_path_get(command[1]), abs_path_get(command[2]),
+                                    [&](int kind, const string &path)
             {
-                status_print(command[2] + " doesn't exists!!");
-                continue;
-            }
-            dest_path += command[1];
-            if(dir_exists(dest_path))
+                if(++n_diffs <= SNAPDIFF_MAX_SHOWN)
+                    snapdiff_result_add(kind, path, folder_path);
+            }, err_msg);
+            if(FAILURE == ret)
             {
-                status_print(command[1] + " already exists at " + command[2]);
+                status_print(err_msg);
                 continue;
             }
-            if(FAILURE == mkdir(dest_path.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH))
-            {
-                status_print("mkdir failed!! errno: " + to_string(errno));
-            }
-            else
+            if(content_list.empty())
             {
-                display_refresh();
+                status_print("No differences found!!");
+                continue;
             }
+            if(n_diffs > SNAPDIFF_MAX_SHOWN)
+                snapdiff_result_add(FAILURE, "... " + to_string(n_diffs - SNAPDIFF_MAX_SHOWN) + " more", "");
+            is_search_content = true;
+            stack_clear(fwd_stack);
+            break;
         }
-        else if(command[0] == "delete_file")
+        else if(command[0] == "dupes")
         {
-            if(FAILURE == command_size_check(command, 2, 2, "delete_file: (usage):- \"delete_file <file_path>\""))
+            if(FAILURE == command_size_check(command, 1, 2, "dupes: (usage):- \"dupes [dir]\""))
                 continue;
 
-            string rem_path = abs_path_get(command[1]);
-            if(!file_exists(rem_path))
+            string dir_arg = (command.size() == 2) ? command[1] : ".";
+            string dir_path = abs_path_get(dir_arg);
+            if(!dir_exists(dir_path))
             {
-                status_print(command[1] + " doesn't exists!!");
+                status_print(dir_arg + " doesn't exist!!");
                 continue;
             }
-            
-            if(FAILURE == unlinkat(0, rem_path.c_str(), 0))
-            {
-                status_print("unlinkat failed!! errno: " + to_string(errno));
-            }
-            else
+
+            /* hashing a large tree takes long: it runs as a job and the groups
+             * replace the listing once it is done
+             */
+            int id = job_submit(job_desc_get(command), [dir_path](op_ctl &ctl, string &err_msg)
             {
-               display_refresh();
-            }
+                vector<dupe_group> groups;
+                dupe_stats stats;
+                if(FAILURE == dupes_find(dir_path, groups, stats, err_msg, &ctl))
+                    return FAILURE;
+
+                if(groups.empty())
+                {
+                    err_msg = "No duplicates among " + to_string(stats.n_files) + " files";
+                    return SUCCESS;
+                }
+                err_msg = to_string(groups.size()) + " groups of duplicates";
+                lock_guard<mutex> lk(dupes_done_lock);
+                dupes_done.swap(groups);
+                is_dupes_done = true;
+                return SUCCESS;
+            });
+            status_print("Job " + to_string(id) + " queued");
         }
-        else if(command[0] == "delete_dir")
+        else if(command[0] == "jobs")
         {
-            if(FAILURE == command_size_check(command, 2, 2, "delete_dir: (usage):- \"delete_dir <directory_path>\""))
-                continue;
-
-            string rem_path = abs_path_get(command[1]);
-            if(!dir_exists(rem_path))
+            string usage = "jobs: (usage):- \"jobs [pause|resume|cancel <job_id>]\"";
+            if(command.size() != 1 && command.size() != 3)
             {
-                status_print(command[1] + " doesn't exist!!");
+                status_print(usage);
                 continue;
             }
-            delete_command(rem_path);
-        }
-        else if(command[0] == "goto")
-        {
-            if(FAILURE == command_size_check(command, 2, 2, "goto: (usage):- \"goto <directory_path>\""))
-                continue;
-
-            string dest_path = abs_path_get(command[1]);
-            if(!dir_exists(dest_path))
+            if(command.size() == 3)
             {
-                status_print(command[1] + " doesn't exist!!");
+                int id = atoi(command[2].c_str());
+                string err_msg, done_msg;
+                int ret = FAILURE;
+                if(command[1] == "pause" || command[1] == "resume")
+                {
+                    ret = job_pause(id, command[1] == "pause", err_msg);
+                    done_msg = (command[1] == "pause") ? " paused" : " resumed";
+                }
+                else if(command[1] == "cancel")
+                {
+                    ret = job_cancel(id, err_msg);
+                    done_msg = " cancelled";
+                }
+                else
+                {
+                    err_msg = usage;
+                }
+                status_print((FAILURE == ret) ? err_msg : "Job " + to_string(id) + done_msg);
                 continue;
             }
-            if(dest_path[dest_path.length() - 1] != '/')
-                dest_path = dest_path + "/";
 
-            if(dest_path == working_dir)
+            vector<job_info> infos;
+            jobs_get(infos);
+            if(infos.empty())
             {
-                status_print("Current directory and Destination directory are the same!!");
+                status_print("No jobs!!");
                 continue;
             }
+            search_stop();
+            listing_discard();
+            for(auto &info : infos)
+            {
+                text_line_add(job_line_get(info));
+                size_t pos = info.err_msg.find('\n');     // files a verified copy failed on
+                while(pos != string::npos)
+                {
+                    size_t end = info.err_msg.find('\n', pos + 1);
+                    text_line_add("        " + info.err_msg.substr(pos + 1, end - pos - 1));
+                    pos = end;
+                }
+            }
+            is_search_content = true;
             stack_clear(fwd_stack);
-            bwd_stack.push(working_dir);
-
-            working_dir = dest_path;
-            display_refresh();
+            break;
         }
-        else if(command[0] == "search")
+        else if(command[0] == "stats")
         {
-            if(FAILURE == command_size_check(command, 2, 2, "search: (usage):- \"search <directory/file_path>\""))
+            if(FAILURE == command_size_check(command, 1, 2, "stats: (usage):- \"stats [reset]\""))
                 continue;
-
-            search_str = command[1];
-            content_list.clear();
-            nftw(working_dir.c_str(), search_cb, ftw_max_fd, 0);
-            if(content_list.empty())
+            if(command.size() == 2)
             {
-                status_print("No match found!!");
+                if(command[1] != "reset")
+                {
+                    status_print("stats: (usage):- \"stats [reset]\"");
+                    continue;
+                }
+                /* the owner names are looked up again, so the counters start cold */
+                stats_reset();
+                name_cache_clear();
+                status_print("Counters and name cache reset");
                 continue;
             }
+            search_stop();
+            listing_discard();
+            stats_lines_add();
             is_search_content = true;
             stack_clear(fwd_stack);
             break;
         }
-        else if(command[0] == "snapshot")
+        else
         {
-            if(FAILURE == command_size_check(command, 3, 3, "snapshot: (usage):- \"snapshot <folder> <dumpfile>\""))
+            /* the file commands, run the same way by batch mode */
+            command_op op;
+            string err_msg;
+            if(FAILURE == command_prepare(command, op, err_msg) || FAILURE == op.check(err_msg))
+            {
+                status_print(err_msg);
                 continue;
-
-            snapshot_folder_path = abs_path_get(command[1]);
-            if(!dir_exists(snapshot_folder_path))
+            }
+            if(op.is_job)
             {
-                status_print(command[1] + " doesn't exist!!");
+                command_fn fn = op.fn;
+                int id = job_submit(op.desc, [fn](op_ctl &ctl, string &err_msg)
+                {
+                    vector<string> lines;
+                    return fn(ctl, err_msg, lines);
+                });
+                status_print("Job " + to_string(id) + " queued");
                 continue;
             }
-            dumpfile_path = abs_path_get(command[2]);
-            ofstream dumpfile (dumpfile_path.c_str(), ios::out | ios::trunc);
-            dumpfile.close();
-            if(snapshot_folder_path[snapshot_folder_path.length() - 1] == '/')
-                snapshot_folder_path.erase(snapshot_folder_path.length() - 1);
 
-            nftw(snapshot_folder_path.c_str(), snapshot_cb, ftw_max_fd, 0);
-            display_refresh();
-        }
-        else
-        {
-            status_print("Invalid Command. Please try again!!");
+            op_ctl ctl;
+            vector<string> lines;
+            if(FAILURE == op.fn(ctl, err_msg, lines))
+                status_print(err_msg);
+            else
+                listing_changed();
         }
     }
     current_mode = MODE_NORMAL;
@@ -374,35 +409,6 @@ int command_size_check(vector<string> &v, unsigned int min_size, unsigned int ma
     return SUCCESS;
 }
 
-bool file_exists(string file_path)
-{
-    if(FAILURE == access(file_path.c_str(), F_OK))
-        return false;
-    else
-        return true;
-}
-
-bool dir_exists(string dir_path)
-{
-    DIR* dir = opendir(dir_path.c_str());
-    if (dir)
-    {
-        /* Directory exists. */
-        closedir(dir);
-        return true;
-    }
-    else if (ENOENT == errno)
-    {
-        /* Directory does not exist. */
-        return false;
-    }
-    else
-    {
-        status_print("opendir() failed!! errno: " + to_string(errno));
-        return false;
-    }
-}
-
 void status_print(string msg)
 {
     if(is_status_on)
@@ -413,201 +419,147 @@ void status_print(string msg)
     cursor_init();
 
     from_cursor_line_clear();
-    cout << "\033[1;31m" << msg << "\033[0m";
-    cout.flush();
+    term_write("\033[1;31m" + msg + "\033[0m");
 }
 
-int copy_file_to_dir(string src_file_path, string dest_dir_path)
+/* waits for the first matches of a search walk, ESC gives up on it.
+ * Returns 1 while the walk goes on, 0 once it is over, FAILURE if cancelled
+ */
+int search_first_results_wait(vector<search_hit> &hits)
 {
-    if(dest_dir_path[dest_dir_path.length() - 1] != '/')
-        dest_dir_path = dest_dir_path + "/";
+    while(1)
+    {
+        bool running = search_walk_drain(hits);
+        if(!hits.empty() || !running)
+            return running ? 1 : 0;
 
-    struct stat src_file_stat;
-    size_t fwd_slash_pos = src_file_path.find_last_of("/");
-    string dest_file_path = dest_dir_path;
-    dest_file_path += src_file_path.substr(fwd_slash_pos + 1);
+        struct pollfd pfds[2] = {{search_walk_fd(), POLLIN, 0}, {STDIN_FILENO, POLLIN, 0}};
+        if((key_pending() || (poll(pfds, 2, -1) > 0 && (pfds[1].revents & POLLIN))) && ESC == next_input_char_get())
+        {
+            search_walk_cancel();
+            return FAILURE;
+        }
+    }
+}
 
-    if(file_exists(dest_file_path))
+/* starts a search walk below root_path and puts its first matches in the
+ * result list, the others are added as they come in
+ */
+int search_walk_show(const string &root_path, const string &pattern, int kind)
+{
+    string err_msg;
+    if(FAILURE == search_walk_start(root_path, pattern, kind, err_msg))
     {
-        status_print("Destination file already exists at the destination directory!!");
+        status_print(err_msg);
         return FAILURE;
     }
-    if(!file_exists(src_file_path))
+    listing_discard();
+
+    vector<search_hit> hits;
+    int state = search_first_results_wait(hits);
+    if(FAILURE == state)
     {
-        status_print("Source file doesn't exist!!");
+        status_print("Search cancelled!!");
         return FAILURE;
     }
-
-    ifstream in(src_file_path);
-    ofstream out(dest_file_path);
-
-    out << in.rdbuf();
-
-    stat(src_file_path.c_str(), &src_file_stat);
-    chmod(dest_file_path.c_str(), src_file_stat.st_mode);
-    chown(dest_file_path.c_str(), src_file_stat.st_uid, src_file_stat.st_gid);
-    return SUCCESS;
-}
-
-int copy_cb(const char* src_path, const struct stat* sb, int typeflag) {
-    string src_path_str(src_path);
-    string dst_path = dest_root + src_path_str.substr(src_dir_pos);
-
-    switch(typeflag) {
-        case FTW_D:
-            if(dir_exists(dst_path))
-            {
-                status_print("Destination directory already exists!!");
-                return FAILURE;
-            }
-            if(FAILURE == mkdir(dst_path.c_str(), sb->st_mode))
-            {
-                status_print("operation failed, errno: " + to_string(errno));
-                return FAILURE;
-            }
-            break;
-        case FTW_F:
-            return copy_file_to_dir(src_path_str, dst_path.substr(0, dst_path.find_last_of("/")));
-    }
+    for(auto &hit : hits)
+        search_result_add(hit.path, hit.where);
+    if(state)
+        search_results_follow();
     return SUCCESS;
 }
 
-int copy_dir_to_dir(string src_dir_path, string dest_dir_path) {
-    dest_root = dest_dir_path;
-    src_dir_pos = src_dir_path.find_last_of("/");
-    return ftw(src_dir_path.c_str(), copy_cb, ftw_max_fd);
+/* appends a search hit to the content list, shown by its path from root and,
+ * for a content match, the line it was found on
+ */
+void search_result_add(const string &path_str, const string &where)
+{
+    string line = "~/" + path_str.substr(root_dir.length());
+    content_list.text_add(where.empty() ? line : line + ":" + where, path_str);
 }
 
-int copy_command(vector<string> &cmd)
+/* adds a difference found by snapdiff to the result list, path is relative
+ * to the snapshot folder
+ */
+void snapdiff_result_add(int kind, const string &path, const string &folder_path)
 {
-    string src_path, dest_path;
-    dest_path = abs_path_get(cmd.back());
-    int ret;
-    for(unsigned int i = 1; i < cmd.size() - 1; ++i)
+    string tag;
+    switch(kind)
     {
-        src_path = abs_path_get(cmd[i]);
-        if(is_directory(src_path))
-        {
-            ret = copy_dir_to_dir(src_path, dest_path);
-        }
-        else
-        {
-            ret = copy_file_to_dir(src_path, dest_path);
-        }
+        case SNAPDIFF_ADDED:    tag = "added    "; break;
+        case SNAPDIFF_REMOVED:  tag = "removed  "; break;
+        case SNAPDIFF_CHANGED:  tag = "changed  "; break;
+        default:                tag = "";          break;
     }
-    if(SUCCESS == ret)
-        display_refresh();
-
-    return ret;
+    content_list.text_add(tag + path, (kind != FAILURE) ? folder_path + path.substr(1) : "");
 }
 
-int delete_cb(const char *path, const struct stat *sb, int typeflag, struct FTW *ftwbuf)
+/* one line per instrumented path in the result list */
+void stats_lines_add()
 {
-    string rem_path(path);
-
-    if(is_directory(rem_path))
-    {
-        if(FAILURE == unlinkat(0, rem_path.c_str(), AT_REMOVEDIR))
-            cout << "unlinkat failed!! errno " << errno;
-    }
-    else
+    vector<stat_snapshot> snaps;
+    stats_get(snaps);
+
+    vector<string> lines;
+    stringstream ss;
+    ss << left << setw(24) << "path" << right << setw(10) << "calls" << setw(13) << "total ms"
+       << setw(11) << "avg us" << setw(11) << "max ms" << setw(11) << "MB/s";
+    lines.pb(ss.str());
+    for(auto &snap : snaps)
     {
-        if(FAILURE == unlinkat(0, rem_path.c_str(), 0))
-            cout << "unlinkat failed!! errno " << errno;
+        ss.str("");
+        ss << fixed << setprecision(2) << left << setw(24) << snap.name << right << setw(10) << snap.calls
+           << setw(13) << snap.total_ns / 1e6 << setw(11) << (snap.calls ? snap.total_ns / 1e3 / snap.calls : 0.0)
+           << setw(11) << snap.max_ns / 1e6;
+        if(snap.bytes && snap.total_ns)
+            ss << setw(11) << snap.bytes / 1e6 / (snap.total_ns / 1e9);
+        lines.pb(ss.str());
     }
-    return 0;
-}
 
-void delete_command(string rem_path)
-{
-    if(SUCCESS == nftw(rem_path.c_str(), delete_cb, ftw_max_fd, FTW_DEPTH | FTW_PHYS))
-        display_refresh();
+    for(auto &line : lines)
+        text_line_add(line);
 }
 
-void move_command(vector<string> &cmd)
+/* a line of text in the result list, not backed by a path */
+void text_line_add(const string &line)
 {
-    if(FAILURE == copy_command(cmd))
-        return;
-
-    string rem_path;
-    for(unsigned int i = 1; i < cmd.size() - 1; ++i)
-    {
-        rem_path = abs_path_get(cmd[i]);
-        delete_command(rem_path);
-    }
+    content_list.text_add(line);
 }
 
-int search_cb(const char *path, const struct stat *sb, int typeflag, struct FTW *ftwbuf)
+/* puts the groups of the last dupes job that found any in the result
+ * list, false if there are none waiting; the caller repaints
+ */
+bool dupes_results_take()
 {
-    string path_str(path), cmp_str;
-    size_t fwd_slash_pos = path_str.find_last_of("/");
-    cmp_str = path_str.substr(fwd_slash_pos + 1);
-
-    if(cmp_str == search_str)
+    vector<dupe_group> groups;
     {
-        dir_content dc;
-        size_t fwd_slash_pos = path_str.find_last_of("/");
-        dc.name = path_str.substr(fwd_slash_pos + 1);
-        dc.content_line = "~/" + path_str.substr(root_dir.length());
-        if(dc.content_line.length() % w.ws_col)
-        {
-            dc.no_lines = (dc.content_line.length() / w.ws_col) + 1;
-        }
-        else
-        {
-            dc.no_lines = (dc.content_line.length() / w.ws_col);
-        }
-        content_list.pb(dc);
+        lock_guard<mutex> lk(dupes_done_lock);
+        if(!is_dupes_done)
+            return false;
+        is_dupes_done = false;
+        groups.swap(dupes_done);
     }
-    return 0;
+    search_stop();
+    listing_discard();
+    dupes_result_add(groups);
+    is_search_content = true;
+    stack_clear(fwd_stack);
+    return true;
 }
 
-
-int snapshot_cb(const char *path, const struct stat *sb, int typeflag, struct FTW *ftwbuf)
+/* a header line per group of duplicates followed by its files */
+void dupes_result_add(const vector<dupe_group> &groups)
 {
-    string snap_path(path);
-    if(!is_directory(snap_path))
-        return 0;
-
-    if(snap_path.find("/.") != string::npos)
-        return 0;
-
-    string line_str;
-
-    struct dirent **dir_entry_arr;
-    struct dirent *dir_entry;
-
-    ofstream dumpfile (dumpfile_path.c_str(), ios::app);
-    line_str = "." + snap_path.substr(snapshot_folder_path.length()) + ":";
-    dumpfile << line_str << endl;
-
-
-    int n = scandir(snap_path.c_str(), &dir_entry_arr, NULL, alphasort);
-    if(n == FAILURE)
+    auto size_str_get = [](off_t size)
     {
-        cout << "Scandir() failed!!\n";
-        return 0;
-    }
-
-    for(int i = 0; i < n; ++i)
+        string str = human_readable_size_get(size);
+        return str.substr(str.find_first_not_of(' '));
+    };
+    for(auto &group : groups)
     {
-        dir_entry = dir_entry_arr[i];
-
-        if(((string)dir_entry->d_name) == "." || ((string)dir_entry->d_name) == ".." ||
-           dir_entry->d_name[0] == '.')
-        {
-            continue;
-        }
-
-        dumpfile << dir_entry->d_name << endl;
-
-        free(dir_entry_arr[i]);
-        dir_entry_arr[i] = NULL;
+        text_line_add(to_string(group.paths.size()) + " copies of " + size_str_get(group.size) +
+                      ", " + size_str_get(group.size * (group.paths.size() - 1)) + " wasted");
+        for(auto &path : group.paths)
+            search_result_add(path);
     }
-    free(dir_entry_arr);
-    dir_entry_arr = NULL;
-
-    dumpfile << endl;
-
-    return 0;
 }
@@ -5,27 +5,27 @@
 #include <string>
 #include <fcntl.h>
 
+#include "commands.h"
+#include "dupes.h"
+#include "file_ops.h"
+#include "search_walk.h"
+
 #define ERROR 0
 #define MSG   1
 
+#define SNAPDIFF_MAX_SHOWN  100000      // differences kept in the result list
+
 void enter_command_mode();
 int  command_size_check(std::vector<std::string> &v, unsigned int, unsigned int, std::string);
-bool file_exists(std::string);
-bool dir_exists(std::string);
 void status_print(std::string);
 
-int  copy_cb(const char*, const struct stat*, int);
-int  copy_command(std::vector<std::string>&);
-int  copy_file_to_dir(std::string, std::string);
-int  copy_dir_to_dir(std::string, std::string);
-
-int  delete_cb(const char*, const struct stat*, int, struct FTW*);
-void delete_command(std::string);
-
-void move_command(std::vector<std::string>&);
-
-int search_cb(const char*, const struct stat*, int, struct FTW*);
-int snapshot_cb(const char*, const struct stat*, int, struct FTW*);
-
+int  search_first_results_wait(std::vector<search_hit>&);
+int  search_walk_show(const std::string&, const std::string&, int);
+void search_result_add(const std::string&, const std::string &where = "");
+void snapdiff_result_add(int, const std::string&, const std::string&);
+void stats_lines_add();
+void text_line_add(const std::string&);
+void dupes_result_add(const std::vector<dupe_group>&);
+bool dupes_results_take();
 
 #endif
@@ -0,0 +1,611 @@
+#include "commands.h"
+#include "name_index.h"
+#include "search_walk.h"
+#include "snapshot.h"
+#include "common.h"
+#include "includes.h"
+
+#include <algorithm>
+#include <fcntl.h>
+
+using namespace std;
+
+vector<string> command_parse(const string &cmd)
+{
+    string part;
+    vector<string> command;
+
+    for(unsigned int i = 0; i < cmd.length(); ++i)
+    {
+        if(cmd[i] == ' ')
+        {
+            if(!part.empty())
+            {
+                command.pb(part);
+                part = "";
+            }
+        }
+        else if(cmd[i] == '\\' && (i < cmd.length() - 1) && cmd[i+1] == ' ')
+        {
+            part += ' ';
+            ++i;
+        }
+        else
+        {
+            part += cmd[i];
+        }
+    }
+    if(!part.empty())
+        command.pb(part);
+    return command;
+}
+
+/* the command line a job was started with, for the job list */
+string job_desc_get(vector<string> &cmd)
+{
+    string desc;
+    for(auto &word : cmd)
+        desc += (desc.empty() ? "" : " ") + word;
+    return desc;
+}
+
+bool file_exists(string file_path)
+{
+    if(FAILURE == access(file_path.c_str(), F_OK))
+        return false;
+    else
+        return true;
+}
+
+bool dir_exists(string dir_path)
+{
+    DIR* dir = opendir(dir_path.c_str());
+    if (dir)
+    {
+        /* Directory exists. */
+        closedir(dir);
+        return true;
+    }
+    return false;
+}
+
+/* maps the queries the filename index can answer (name, prefix*, *part*)
+ * to their INDEX_* kind and strips the wildcards; FAILURE for other globs
+ */
+int index_match_get(string &query)
+{
+    size_t len = query.length();
+    size_t wildcard_pos = query.find_first_of("*?[");
+    if(wildcard_pos == string::npos)
+        return INDEX_EXACT;
+
+    if(len > 1 && wildcard_pos == len - 1 && query[len - 1] == '*')
+    {
+        query.erase(len - 1);
+        return INDEX_PREFIX;
+    }
+    if(len > 2 && query[0] == '*' && query[len - 1] == '*' &&
+       query.find_first_of("*?[", 1) == len - 1)
+    {
+        query = query.substr(1, len - 2);
+        return INDEX_SUBSTR;
+    }
+    return FAILURE;
+}
+
+/* runs on the job runner, reports through err_msg only */
+int copy_file_to_dir(string src_file_path, string dest_dir_path, string &err_msg, op_ctl *ctl, copy_verify *verify)
+{
+    if(dest_dir_path[dest_dir_path.length() - 1] != '/')
+        dest_dir_path = dest_dir_path + "/";
+
+    size_t fwd_slash_pos = src_file_path.find_last_of("/");
+    string dest_file_path = dest_dir_path;
+    dest_file_path += src_file_path.substr(fwd_slash_pos + 1);
+
+    if(file_exists(dest_file_path))
+    {
+        err_msg = "Destination file already exists at the destination directory!!";
+        return FAILURE;
+    }
+    if(!file_exists(src_file_path))
+    {
+        err_msg = "Source file doesn't exist!!";
+        return FAILURE;
+    }
+    return file_copy(src_file_path, dest_file_path, err_msg, ctl, verify);
+}
+
+int copy_dir_to_dir(string src_dir_path, string dest_dir_path, string &err_msg, op_ctl *ctl, copy_verify *verify)
+{
+    return tree_copy(src_dir_path, dest_dir_path, err_msg, ctl, verify);
+}
+
+static int args_check(vector<string> &v, unsigned int min_size, unsigned int max_size, const string &usage,
+                      string &err_msg)
+{
+    if(v.size() < min_size || v.size() > max_size)
+    {
+        err_msg = usage;
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+static string path_trim(string path)
+{
+    while(path.length() > 1 && path[path.length() - 1] == '/')
+        path.erase(path.length() - 1);
+    return path;
+}
+
+/* where src_path ends up inside dest_dir_path */
+static string dest_child_get(const string &src_path, const string &dest_dir_path)
+{
+    string src = path_trim(src_path);
+    return path_trim(dest_dir_path) + "/" + src.substr(src.find_last_of("/") + 1);
+}
+
+static int copy_prepare(vector<string> &cmd, command_op &op, string &err_msg)
+{
+    string usage = "copy: (usage):- \"copy [--verify] [--manifest <file>] <source_file/dir(s)>"
+                   " <destination_directory>\"";
+    bool verify = false;
+    string manifest_path;
+    while(cmd.size() > 1 && cmd[1].compare(0, 2, "--") == 0)
+    {
+        if(cmd[1] == "--manifest" && cmd.size() > 2)
+        {
+            manifest_path = abs_path_get(cmd[2]);     // only a verified copy has sums to write
+            cmd.erase(cmd.begin() + 2);
+        }
+        else if(cmd[1] != "--verify")
+        {
+            err_msg = usage;
+            return FAILURE;
+        }
+        verify = true;
+        cmd.erase(cmd.begin() + 1);
+    }
+    if(FAILURE == args_check(cmd, 3, INT_MAX, usage, err_msg))
+        return FAILURE;
+
+    string dest_arg = cmd.back(), dest_path = abs_path_get(dest_arg);
+    vector<string> src_args(cmd.begin() + 1, cmd.end() - 1), src_paths;
+    for(auto &arg : src_args)
+    {
+        src_paths.pb(abs_path_get(arg));
+        op.reads.pb(src_paths.back());
+        op.writes.pb(dest_child_get(src_paths.back(), dest_path));
+    }
+    if(!manifest_path.empty())
+        op.writes.pb(manifest_path);
+
+    op.is_job = true;
+    op.check = [dest_arg, dest_path, src_args, src_paths](string &err_msg)
+    {
+        if(!dir_exists(dest_path))
+        {
+            err_msg = dest_arg + " doesn't exist!!";
+            return FAILURE;
+        }
+        for(unsigned int i = 0; i < src_paths.size(); ++i)
+        {
+            if(!file_exists(src_paths[i]))
+            {
+                err_msg = src_args[i] + " doesn't exist!!";
+                return FAILURE;
+            }
+        }
+        return SUCCESS;
+    };
+
+    /* a verified copy lists every file that failed after its summary line,
+     * and writes its checksums to manifest_path if one is given
+     */
+    op.fn = [src_paths, dest_path, verify, manifest_path](op_ctl &ctl, string &err_msg, vector<string> &lines)
+    {
+        for(auto &src_path : src_paths)
+            tree_totals_add(src_path, ctl);
+
+        int ret = SUCCESS;
+        copy_verify sums;
+        copy_verify *vp = verify ? &sums : NULL;
+        for(auto &src_path : src_paths)
+        {
+            string msg;
+            if(is_directory(src_path))
+                msg = (FAILURE == copy_dir_to_dir(src_path, dest_path, msg, &ctl, vp)) ? msg : "";
+            else
+                msg = (FAILURE == copy_file_to_dir(src_path, dest_path, msg, &ctl, vp)) ? msg : "";
+            if(msg.empty())
+                continue;
+
+            ret = FAILURE;
+            if(err_msg.empty())
+                err_msg = msg;
+            if(ctl.cancelled)
+                break;
+        }
+        if(!verify || ctl.cancelled)
+            return ret;
+
+        /* the first line is the summary, the failed files follow */
+        string note = to_string(sums.sums.size()) + " files verified";
+        if(sums.n_failed)
+            note = to_string(sums.n_failed) + " files failed, " + note;
+        if(!manifest_path.empty())
+        {
+            string msg;
+            if(FAILURE == manifest_write(manifest_path, sums, msg))
+            {
+                ret = FAILURE;
+                note += ", manifest: " + msg;
+            }
+        }
+        if(!err_msg.empty() && !sums.n_failed)
+            note = err_msg + " (" + note + ")";
+        for(auto &failure : sums.failures)
+            note += "\n" + failure;
+        if(sums.n_failed > sums.failures.size())
+            note += "\n... " + to_string(sums.n_failed - sums.failures.size()) + " more";
+        err_msg = note;
+        return ret;
+    };
+    return SUCCESS;
+}
+
+static int move_prepare(vector<string> &cmd, command_op &op, string &err_msg)
+{
+    if(FAILURE == args_check(cmd, 3, INT_MAX, "move: (usage):- \"move <source_file/dir(s)>"
+                                              " <destination_directory>\"", err_msg))
+        return FAILURE;
+
+    string dest_arg = cmd.back(), dest_path = abs_path_get(dest_arg);
+    vector<string> src_paths;
+    for(unsigned int i = 1; i < cmd.size() - 1; ++i)
+    {
+        src_paths.pb(abs_path_get(cmd[i]));
+        op.writes.pb(src_paths.back());
+        op.writes.pb(dest_child_get(src_paths.back(), dest_path));
+    }
+
+    op.is_job = true;
+    op.check = [dest_arg, dest_path](string &err_msg)
+    {
+        if(!dir_exists(dest_path))
+        {
+            err_msg = dest_arg + " doesn't exist!!";
+            return FAILURE;
+        }
+        return SUCCESS;
+    };
+    op.fn = [src_paths, dest_path](op_ctl &ctl, string &err_msg, vector<string> &lines)
+    {
+        int ret = SUCCESS;
+        for(auto &src_path : src_paths)
+        {
+            string msg;
+            if(SUCCESS == path_move(src_path, dest_path, msg, &ctl))
+                continue;
+
+            ret = FAILURE;
+            if(err_msg.empty())
+                err_msg = msg;
+            if(ctl.cancelled)
+                break;
+        }
+        return ret;
+    };
+    return SUCCESS;
+}
+
+static int rename_prepare(vector<string> &cmd, command_op &op, string &err_msg)
+{
+    if(FAILURE == args_check(cmd, 3, 3, "rename: (usage):- \"rename <source_file/dir>"
+                                        " <destination_file/dir>\"", err_msg))
+        return FAILURE;
+
+    string old_arg = cmd[1], new_arg = cmd[2];
+    string old_path = abs_path_get(old_arg), new_path = abs_path_get(new_arg);
+    op.writes = {old_path, new_path};
+    op.check = [old_arg, new_arg, old_path, new_path](string &err_msg)
+    {
+        bool is_dir = is_directory(old_path);
+        if(is_dir ? !dir_exists(old_path) : !file_exists(old_path))
+        {
+            err_msg = old_arg + " doesn't exist!!";
+            return FAILURE;
+        }
+        if(is_dir ? dir_exists(new_path) : file_exists(new_path))
+        {
+            err_msg = new_arg + " already exists!!";
+            return FAILURE;
+        }
+        return SUCCESS;
+    };
+    op.fn = [old_path, new_path](op_ctl &ctl, string &err_msg, vector<string> &lines)
+    {
+        if(FAILURE == rename(old_path.c_str(), new_path.c_str()))
+        {
+            err_msg = "rename failed!! errno: " + to_string(errno);
+            return FAILURE;
+        }
+        return SUCCESS;
+    };
+    return SUCCESS;
+}
+
+/* create_file and create_dir */
+static int create_prepare(vector<string> &cmd, command_op &op, string &err_msg)
+{
+    bool is_dir = (cmd[0] == "create_dir");
+    string usage = is_dir ? "create_dir: (usage):- \"create_dir <new_dir> <destination_dir>\""
+                          : "create_file: (usage):- \"create_file <new_file> <destination_dir>\"";
+    if(FAILURE == args_check(cmd, 3, 3, usage, err_msg))
+        return FAILURE;
+
+    string name = cmd[1], dest_arg = cmd[2];
+    string dest_path = abs_path_get(dest_arg);
+    if(dest_path[dest_path.length() - 1] != '/')
+        dest_path = dest_path + "/";
+    string new_path = dest_path + name;
+    op.writes = {new_path};
+
+    op.check = [is_dir, name, dest_arg, dest_path, new_path](string &err_msg)
+    {
+        if(!dir_exists(dest_path))
+        {
+            err_msg = dest_arg + " doesn't exists!!";
+            return FAILURE;
+        }
+        if(is_dir ? dir_exists(new_path) : file_exists(new_path))
+        {
+            err_msg = name + " already exists at " + dest_arg;
+            return FAILURE;
+        }
+        return SUCCESS;
+    };
+    op.fn = [is_dir, new_path](op_ctl &ctl, string &err_msg, vector<string> &lines)
+    {
+        if(is_dir)
+        {
+            if(FAILURE == mkdir(new_path.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH))
+            {
+                err_msg = "mkdir failed!! errno: " + to_string(errno);
+                return FAILURE;
+            }
+            return SUCCESS;
+        }
+
+        int fd = open(new_path.c_str(), O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
+        if(FAILURE == fd)
+        {
+            err_msg = "open failed!! errno: " + to_string(errno);
+            return FAILURE;
+        }
+        close(fd);
+        return SUCCESS;
+    };
+    return SUCCESS;
+}
+
+/* delete_file and delete_dir */
+static int delete_prepare(vector<string> &cmd, command_op &op, string &err_msg)
+{
+    bool is_dir = (cmd[0] == "delete_dir");
+    string usage = is_dir ? "delete_dir: (usage):- \"delete_dir <directory_path>\""
+                          : "delete_file: (usage):- \"delete_file <file_path>\"";
+    if(FAILURE == args_check(cmd, 2, 2, usage, err_msg))
+        return FAILURE;
+
+    string rem_arg = cmd[1], rem_path = abs_path_get(rem_arg);
+    op.writes = {rem_path};
+    op.is_job = is_dir;
+    op.check = [is_dir, rem_arg, rem_path](string &err_msg)
+    {
+        if(is_dir ? !dir_exists(rem_path) : !file_exists(rem_path))
+        {
+            err_msg = rem_arg + (is_dir ? " doesn't exist!!" : " doesn't exists!!");
+            return FAILURE;
+        }
+        return SUCCESS;
+    };
+    op.fn = [is_dir, rem_path](op_ctl &ctl, string &err_msg, vector<string> &lines)
+    {
+        if(!is_dir)
+        {
+            if(FAILURE == unlinkat(0, rem_path.c_str(), 0))
+            {
+                err_msg = "unlinkat failed!! errno: " + to_string(errno);
+                return FAILURE;
+            }
+            return SUCCESS;
+        }
+
+        tree_totals_add(rem_path, ctl);
+        ctl.bytes_total = 0;        // nothing is read, only the file count tells
+        return tree_delete(rem_path, err_msg, &ctl);
+    };
+    return SUCCESS;
+}
+
+static int snapshot_prepare(vector<string> &cmd, command_op &op, string &err_msg)
+{
+    string usage = "snapshot: (usage):- \"snapshot [--binary] <folder> <dumpfile>\" | "
+                   "\"snapshot --incremental <folder> <dumpfile> <previous>\"";
+    int format = SNAPSHOT_TEXT;
+    bool incremental = false;
+    if(cmd.size() > 1 && (cmd[1] == "--binary" || cmd[1] == "--incremental"))
+    {
+        format = SNAPSHOT_BINARY;       // an incremental one is the previous of the next
+        incremental = (cmd[1] == "--incremental");
+        cmd.erase(cmd.begin() + 1);
+    }
+    if(FAILURE == args_check(cmd, incremental ? 4 : 3, incremental ? 4 : 3, usage, err_msg))
+        return FAILURE;
+
+    string folder_arg = cmd[1];
+    string folder_path = path_trim(abs_path_get(folder_arg));
+    string dump_path = abs_path_get(cmd[2]);
+    string prev_path = incremental ? abs_path_get(cmd[3]) : "";
+    op.reads = {folder_path};
+    if(incremental)
+        op.reads.pb(prev_path);
+    op.writes = {dump_path};
+
+    op.is_job = true;
+    op.check = [folder_arg, folder_path](string &err_msg)
+    {
+        if(!dir_exists(folder_path))
+        {
+            err_msg = folder_arg + " doesn't exist!!";
+            return FAILURE;
+        }
+        return SUCCESS;
+    };
+    op.fn = [=](op_ctl &ctl, string &err_msg, vector<string> &lines)
+    {
+        snapshot_stats stats;
+        if(FAILURE == snapshot_write(folder_path, dump_path, format, prev_path, stats, err_msg, &ctl))
+            return FAILURE;
+
+        /* noted next to "done" in the job list */
+        if(stats.n_unreadable)
+            err_msg = to_string(stats.n_unreadable) + " directories could not be read!!";
+        else if(incremental)
+            err_msg = to_string(stats.n_dirs - stats.n_reused) + " of " + to_string(stats.n_dirs) +
+                      " directories read again";
+        return SUCCESS;
+    };
+    return SUCCESS;
+}
+
+/* runs a search walk to its end, matches sorted by file */
+static int search_walk_run(const string &root_path, const string &pattern, int kind, vector<string> &lines,
+                           string &err_msg)
+{
+    if(FAILURE == search_walk_start(root_path, pattern, kind, err_msg))
+        return FAILURE;
+
+    vector<search_hit> hits;
+    while(search_walk_drain(hits))
+        search_walk_wait(-1);
+    search_walk_drain(hits);
+    search_walk_cancel();
+
+    /* a file's matches come in line order, only the files are sorted */
+    stable_sort(hits.begin(), hits.end(), [](const search_hit &a, const search_hit &b) { return a.path < b.path; });
+    for(auto &hit : hits)
+        lines.pb(hit.where.empty() ? hit.path : hit.path + ":" + hit.where);
+    return SUCCESS;
+}
+
+/* search and grep, with their matches as the lines of the result; command
+ * mode shows them as they come in instead
+ */
+static int search_prepare(vector<string> &cmd, command_op &op, string &err_msg)
+{
+    bool is_grep = (cmd[0] == "grep");
+    if(is_grep)
+    {
+        if(FAILURE == args_check(cmd, 2, 3, "grep: (usage):- \"grep <text> [dir]\"", err_msg))
+            return FAILURE;
+    }
+    else
+    {
+        string usage = "search: (usage):- \"search <name> | <glob> | -r <regex>\"";
+        if(FAILURE == args_check(cmd, 2, 3, usage, err_msg))
+            return FAILURE;
+        if(cmd.size() == 3 && cmd[1] != "-r")
+        {
+            err_msg = usage;
+            return FAILURE;
+        }
+    }
+
+    string dir_arg = (is_grep && cmd.size() == 3) ? cmd[2] : ".";
+    string root_path = path_trim(abs_path_get(dir_arg));
+    string query = is_grep ? cmd[1] : cmd.back();
+    int kind = is_grep ? SEARCH_CONTENT : (cmd.size() == 3 ? SEARCH_REGEX : SEARCH_GLOB);
+    op.reads = {root_path};
+    op.is_search = true;
+
+    op.check = [dir_arg, root_path](string &err_msg)
+    {
+        if(!dir_exists(root_path))
+        {
+            err_msg = dir_arg + " doesn't exist!!";
+            return FAILURE;
+        }
+        return SUCCESS;
+    };
+    op.fn = [root_path, query, kind](op_ctl &ctl, string &err_msg, vector<string> &lines)
+    {
+        string index_query = query;
+        int match = (kind == SEARCH_GLOB) ? index_match_get(index_query) : FAILURE;
+        if(match == FAILURE)
+            return search_walk_run(root_path, query, kind, lines, err_msg);
+
+        /* name, prefix* and *part* are answered from the filename index */
+        if(FAILURE == name_index_search(root_path == "/" ? root_path : root_path + "/", match, index_query,
+                                        lines, err_msg))
+            return FAILURE;
+        sort(lines.begin(), lines.end());
+        return SUCCESS;
+    };
+    return SUCCESS;
+}
+
+int command_prepare(vector<string> &command, command_op &op, string &err_msg)
+{
+    op.desc = job_desc_get(command);
+    if(command[0] == "copy")
+        return copy_prepare(command, op, err_msg);
+    if(command[0] == "move")
+        return move_prepare(command, op, err_msg);
+    if(command[0] == "rename")
+        return rename_prepare(command, op, err_msg);
+    if(command[0] == "create_file" || command[0] == "create_dir")
+        return create_prepare(command, op, err_msg);
+    if(command[0] == "delete_file" || command[0] == "delete_dir")
+        return delete_prepare(command, op, err_msg);
+    if(command[0] == "snapshot")
+        return snapshot_prepare(command, op, err_msg);
+    if(command[0] == "search" || command[0] == "grep")
+        return search_prepare(command, op, err_msg);
+
+    err_msg = "Invalid Command. Please try again!!";
+    return FAILURE;
+}
+
+/* one path lies within the other, or they are the same */
+static bool paths_overlap(const string &a, const string &b)
+{
+    string x = path_trim(a), y = path_trim(b);
+    if(x.length() > y.length())
+        swap(x, y);
+    if(x == "/")
+        return true;
+    return y.compare(0, x.length(), x) == 0 && (y.length() == x.length() || y[x.length()] == '/');
+}
+
+static bool paths_any_overlap(const vector<string> &a, const vector<string> &b)
+{
+    for(auto &x : a)
+        for(auto &y : b)
+            if(paths_overlap(x, y))
+                return true;
+    return false;
+}
+
+/* whether second has to wait for first: one writes where the other reads
+ * or writes
+ */
+bool command_ops_conflict(const command_op &first, const command_op &second)
+{
+    if(first.is_search && second.is_search)
+        return true;
+    return paths_any_overlap(first.writes, second.writes) || paths_any_overlap(first.writes, second.reads) ||
+           paths_any_overlap(first.reads, second.writes);
+}
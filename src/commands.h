@@ -0,0 +1,51 @@
+#ifndef _COMMANDS_H_
+#define _COMMANDS_H_
+
+#include <string>
+#include <vector>
+#include <functional>
+
+#include "file_ops.h"
+
+typedef std::function<int(std::string &err_msg)> command_check_fn;
+typedef std::function<int(op_ctl &ctl, std::string &err_msg, std::vector<std::string> &lines)> command_fn;
+
+/* a file command with its paths made absolute, independent of the
+ * terminal so that command mode and batch mode run the same code.
+ * check() looks at the arguments against the filesystem and is quick,
+ * fn() does the work and puts what a search finds in lines.
+ * reads and writes are the paths the command touches: commands sharing
+ * none of them may run side by side.
+ */
+struct command_op
+{
+    std::string               desc;         // the command as typed
+    command_check_fn          check;
+    command_fn                fn;
+    std::vector<std::string>  reads;
+    std::vector<std::string>  writes;
+    bool                      is_job;       // long running, a background job in command mode
+    bool                      is_search;    // searches run one at a time, there is a single walk
+
+    command_op(): is_job(false), is_search(false) {}
+};
+
+/* splits a command line into words; "\ " keeps a space inside a word */
+std::vector<std::string> command_parse(const std::string &line);
+
+/* copy, move, rename, create_file, create_dir, delete_file, delete_dir,
+ * snapshot, search and grep. Paths are resolved against working_dir as it
+ * is now; FAILURE with the usage in err_msg for bad arguments
+ */
+int  command_prepare(std::vector<std::string> &command, command_op &op, std::string &err_msg);
+bool command_ops_conflict(const command_op &first, const command_op &second);
+
+std::string job_desc_get(std::vector<std::string>&);
+bool file_exists(std::string);
+bool dir_exists(std::string);
+int  index_match_get(std::string&);
+
+int  copy_file_to_dir(std::string, std::string, std::string&, op_ctl*, copy_verify *verify = NULL);
+int  copy_dir_to_dir(std::string, std::string, std::string&, op_ctl*, copy_verify *verify = NULL);
+
+#endif
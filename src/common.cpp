@@ -2,45 +2,180 @@
 #include "includes.h"
 #include "normal_mode.h"
 #include "command_mode.h"
+#include "render.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <vector>
 
 using namespace std;
 
 extern string  working_dir;
 extern string  root_dir;
-extern termios new_attr;
 
 struct winsize w;
 
+struct input_source
+{
+    int              fd;
+    input_source_cb  cb;
+};
+
+static vector<input_source> input_sources;
+
+/* other descriptors (e.g. search results) served while waiting for a key */
+void input_source_add(int fd, input_source_cb cb)
+{
+    input_source_remove(fd);
+    input_sources.pb({fd, cb});
+}
+
+void input_source_remove(int fd)
+{
+    for(auto itr = input_sources.begin(); itr != input_sources.end(); ++itr)
+    {
+        if(itr->fd == fd)
+        {
+            input_sources.erase(itr);
+            return;
+        }
+    }
+}
+
+/* blocks until a key is waiting, running the callbacks of the other input
+ * sources as they become readable
+ */
+static void key_wait()
+{
+    while(1)
+    {
+        vector<struct pollfd> pfds;
+        pfds.pb({STDIN_FILENO, POLLIN, 0});
+        for(auto &src : input_sources)
+            pfds.pb({src.fd, POLLIN, 0});
+
+        if(poll(pfds.data(), pfds.size(), -1) < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            return;
+        }
+        if(pfds[0].revents)
+            return;
+
+        vector<input_source> ready;
+        for(unsigned int i = 1; i < pfds.size(); ++i)
+        {
+            if(pfds[i].revents)
+                ready.pb(input_sources[i - 1]);
+        }
+        for(auto &src : ready)
+            src.cb(src.fd);
+        term_flush();
+    }
+}
+
+/* every byte the terminal has sent so far and no key was made of yet */
+static string key_buf;
+static size_t key_buf_pos;
+
+/* appends whatever stdin has, waiting up to timeout_ms for the first byte;
+ * false if nothing came
+ */
+static bool key_buf_fill(int timeout_ms)
+{
+    struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+    int ret;
+    while((ret = poll(&pfd, 1, timeout_ms)) < 0 && errno == EINTR);
+    if(ret <= 0)
+        return false;
+
+    char buf[KEY_BUF_SIZE];
+    ssize_t n;
+    while((n = read(STDIN_FILENO, buf, sizeof(buf))) < 0 && errno == EINTR);
+    if(n <= 0)
+        return false;
+
+    if(key_buf_pos == key_buf.length())
+    {
+        key_buf.clear();
+        key_buf_pos = 0;
+    }
+    key_buf.append(buf, n);
+    return true;
+}
+
+/* the byte at offset off of the unread input, FAILURE if it has not come
+ * within timeout_ms
+ */
+static int key_byte_peek(size_t off, int timeout_ms)
+{
+    while(key_buf_pos + off >= key_buf.length())
+    {
+        if(!key_buf_fill(timeout_ms))
+            return FAILURE;
+    }
+    return (unsigned char) key_buf[key_buf_pos + off];
+}
+
+/* bytes the key at the head of the input takes: the arrows come as
+ * ESC [ x (ESC O x in application mode), a lone ESC is one byte if
+ * nothing follows it in ESC_WAIT_MS
+ */
+static size_t key_length_get(int timeout_ms)
+{
+    if(key_byte_peek(0, timeout_ms) != ESC)
+        return 1;
+    int next = key_byte_peek(1, ESC_WAIT_MS);
+    if((next != '[' && next != 'O') || FAILURE == key_byte_peek(2, ESC_WAIT_MS))
+        return 1;
+    return 3;
+}
+
+bool key_pending()
+{
+    return key_buf_pos < key_buf.length();
+}
+
 char next_input_char_get()
 {
-    cin.clear();
-    char ch = cin.get();
-    switch(ch)
+    if(!key_pending())
     {
-        case ESC:
-            new_attr.c_cc[VMIN] = 0;
-            new_attr.c_cc[VTIME] = 1;
-            tcsetattr( STDIN_FILENO, TCSANOW, &new_attr);
+        term_flush();   // all the keys that came together go out as one write
+        key_wait();
+        if(!key_buf_fill(0))
+            return FAILURE;
+    }
 
-            if(FAILURE != cin.get())    // FAILURE is return if ESC is pressed
-            {
-                ch = cin.get();         // For UP, DOWN, LEFT, RIGHT
-            }
-            new_attr.c_cc[VMIN] = 1;
-            new_attr.c_cc[VTIME] = 0;
-            tcsetattr( STDIN_FILENO, TCSANOW, &new_attr);
-            break;
+    size_t len = key_length_get(0);
+    char ch = key_buf[key_buf_pos + len - 1];   // the last byte tells the arrows apart
+    key_buf_pos += len;
+    return ch;
+}
 
-        default:
+/* takes the copies of key that are next in the input, read or still
+ * unread, without waiting for more; returns how many there were
+ */
+int key_repeats_take(char key)
+{
+    key_buf_fill(0);
+
+    int n = 0;
+    while(key_pending())
+    {
+        size_t len = key_length_get(0);
+        if(len != 3 || key_buf[key_buf_pos + 2] != key)
             break;
+        key_buf_pos += len;
+        ++n;
     }
-    return ch;
+    return n;
 }
 
 void from_cursor_line_clear()
 {
-    cout << "\e[0K";
-    cout.flush();
+    term_write("\e[0K");
 }
 
 bool is_directory(string str)
@@ -109,13 +244,84 @@ string abs_path_get(string str)
     return ret_path;
 }
 
+/* the handlers only note the signal in the pipe, it is served with the
+ * other input sources once the main loop is back to waiting for a key
+ */
+static int signal_pipe[2] = {-1, -1};
+
 void win_resize_handler(int sig)
 {
+    int saved_errno = errno;
+    char c = sig;
+    if(write(signal_pipe[1], &c, 1) < 0) {}     // full: a resize is pending anyway
+    errno = saved_errno;
+}
+
+static void signals_apply(int fd)
+{
+    char buf[64];
+    bool resized = false;
+    ssize_t n;
+    while((n = read(fd, buf, sizeof(buf))) > 0 || (n < 0 && errno == EINTR))
+    {
+        for(ssize_t i = 0; i < n; ++i)
+            resized |= (buf[i] == SIGWINCH);
+    }
+    if(!resized)
+        return;
+
     ioctl(0, TIOCGWINSZ, &w);
+    render_invalidate();
     display_refresh();
 }
 
+int signals_init()
+{
+    if(FAILURE == pipe2(signal_pipe, O_NONBLOCK | O_CLOEXEC))
+        return FAILURE;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = win_resize_handler;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if(FAILURE == sigaction(SIGWINCH, &sa, NULL))
+        return FAILURE;
+
+    input_source_add(signal_pipe[0], signals_apply);
+    return SUCCESS;
+}
+
 void stack_clear(stack<string> &s)
 {
     while(!s.empty()) s.pop();
 }
+
+/* str as the contents of a JSON string */
+string json_escape(const string &str)
+{
+    string out;
+    for(char c : str)
+    {
+        if(c == '"' || c == '\\')
+        {
+            out += '\\';
+            out += c;
+        }
+        else if(c == '\n')
+        {
+            out += "\\n";
+        }
+        else if((unsigned char) c < ' ')
+        {
+            char esc[8];
+            snprintf(esc, sizeof(esc), "\\u%04x", c);
+            out += esc;
+        }
+        else
+        {
+            out += c;
+        }
+    }
+    return out;
+}
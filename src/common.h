@@ -14,6 +14,9 @@
 #define BACKSPACE      127
 #define COLON          58
 
+#define KEY_BUF_SIZE   4096
+#define ESC_WAIT_MS    100      // what follows ESC in a key comes within this, else it is ESC itself
+
 #include <string>
 #include <stack>
 
@@ -23,11 +26,19 @@ enum Mode
     MODE_COMMAND
 };
 
+typedef void (*input_source_cb)(int fd);
+
 char         next_input_char_get();
+bool         key_pending();
+int          key_repeats_take(char key);
+void         input_source_add(int fd, input_source_cb cb);
+void         input_source_remove(int fd);
 void         from_cursor_line_clear();
 bool         is_directory(std::string str);
 void         win_resize_handler(int sig);
+int          signals_init();
 std::string  abs_path_get(std::string str);
 void         stack_clear(std::stack<std::string> &s);
+std::string  json_escape(const std::string &str);
 
 #endif
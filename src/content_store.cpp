@@ -0,0 +1,393 @@
+#include "content_store.h"
+#include "dir_scan.h"
+#include "thread_pool.h"
+#include "common.h"
+
+#include <algorithm>
+#include <cstring>
+#include <sys/stat.h>
+
+using namespace std;
+
+void content_store::clear()
+{
+    recs.clear();
+    arena.clear();
+    n_dead = 0;
+}
+
+void content_store::swap(content_store &other)
+{
+    recs.swap(other.recs);
+    arena.swap(other.arena);
+    std::swap(n_dead, other.n_dead);
+    std::swap(order, other.order);
+}
+
+void content_store::reserve(size_t n_rows, size_t n_bytes)
+{
+    recs.reserve(n_rows);
+    arena.reserve(n_bytes);
+}
+
+/* position 0 of the arena is an empty string, the path of every entry row */
+uint32_t content_store::str_add(const char *str, size_t len)
+{
+    if(arena.empty())
+        arena.pb('\0');
+    uint32_t off = arena.size();
+    arena.insert(arena.end(), str, str + len);
+    arena.pb('\0');
+    return off;
+}
+
+void content_store::rec_fill(content_rec &rec, const scan_entry &entry)
+{
+    rec.path_off = rec.path_len = 0;
+    rec.mode = entry.mode;
+    rec.uid = entry.uid;
+    rec.gid = entry.gid;
+    rec.size = entry.size;
+    rec.mtime = entry.mtime;
+    rec.total = 0;
+    rec.flags = entry.stat_ok ? CONTENT_STAT_OK : 0;
+}
+
+void content_store::entry_add(const scan_entry &entry)
+{
+    entry_insert(recs.size(), entry);
+}
+
+void content_store::entry_insert(size_t pos, const scan_entry &entry)
+{
+    content_rec rec;
+    rec_fill(rec, entry);
+    rec.name_off = str_add(entry.name.data(), entry.name.length());
+    rec.name_len = entry.name.length();
+    recs.insert(recs.begin() + pos, rec);
+}
+
+/* the name of a row does not change, only its attributes */
+void content_store::entry_set(size_t pos, const scan_entry &entry)
+{
+    rec_fill(recs[pos], entry);
+}
+
+void content_store::text_add(const string &text, const string &path)
+{
+    content_rec rec = {};
+    rec.name_off = str_add(text.data(), text.length());
+    rec.name_len = text.length();
+    if(!path.empty())
+    {
+        rec.path_off = str_add(path.data(), path.length());
+        rec.path_len = path.length();
+    }
+    rec.flags = CONTENT_TEXT;
+    recs.pb(rec);
+}
+
+void content_store::erase(size_t pos)
+{
+    n_dead += recs[pos].name_len + 1 + (recs[pos].path_len ? recs[pos].path_len + 1 : 0);
+    recs.erase(recs.begin() + pos);
+    if(n_dead > arena.size() / 2)
+        arena_compact();
+}
+
+/* drops the strings of erased rows once they are half of the arena */
+void content_store::arena_compact()
+{
+    vector<char> packed;
+    packed.reserve(arena.size() - n_dead);
+    packed.pb('\0');
+    for(auto &rec : recs)
+    {
+        uint32_t off = packed.size();
+        packed.insert(packed.end(), arena.begin() + rec.name_off, arena.begin() + rec.name_off + rec.name_len + 1);
+        rec.name_off = off;
+        if(rec.path_len)
+        {
+            off = packed.size();
+            packed.insert(packed.end(), arena.begin() + rec.path_off, arena.begin() + rec.path_off + rec.path_len + 1);
+            rec.path_off = off;
+        }
+    }
+    arena.swap(packed);
+    n_dead = 0;
+}
+
+void content_store::entry_get(size_t pos, scan_entry &entry) const
+{
+    const content_rec &rec = recs[pos];
+    entry.name.assign(arena.data() + rec.name_off, rec.name_len);
+    entry.mode = rec.mode;
+    entry.uid = rec.uid;
+    entry.gid = rec.gid;
+    entry.size = rec.size;
+    entry.mtime = rec.mtime;
+    entry.stat_ok = rec.flags & CONTENT_STAT_OK;
+}
+
+void content_store::total_set(size_t pos, int64_t bytes)
+{
+    recs[pos].total = bytes;
+    recs[pos].flags |= CONTENT_TOTAL;
+}
+
+void content_store::totals_clear()
+{
+    for(auto &rec : recs)
+        rec.flags &= ~CONTENT_TOTAL;
+}
+
+/* what a row is ordered by: rank first ("." and ".." on top), then num,
+ * then the bytes of text, made once per row so that comparing two rows
+ * never goes back to strcoll()
+ */
+struct sort_key
+{
+    uint8_t   rank;
+    int64_t   num;
+    string    text;
+    uint32_t  pos;
+};
+
+static bool key_less(const sort_key &a, const sort_key &b)
+{
+    if(a.rank != b.rank)
+        return a.rank < b.rank;
+    if(a.num != b.num)
+        return a.num < b.num;
+    int cmp = a.text.compare(b.text);
+    if(cmp)
+        return cmp < 0;
+    return a.pos < b.pos;
+}
+
+/* the name as strcoll() would compare it */
+static void collate_key_add(string &key, const char *name)
+{
+    size_t len = strlen(name);
+    size_t old_len = key.length();
+    key.resize(old_len + len + 1);
+    size_t n = strxfrm(&key[old_len], name, len + 1);
+    if(n > len)
+    {
+        key.resize(old_len + n + 1);
+        strxfrm(&key[old_len], name, n + 1);
+    }
+    key.resize(old_len + n);
+}
+
+/* the name with every digit run replaced by its length and its digits
+ * without leading zeros, so that "a9" < "a10"
+ */
+static void natural_key_add(string &key, const char *name)
+{
+    for(const char *c = name; *c; )
+    {
+        if(!isdigit((unsigned char) *c))
+        {
+            key += *c++;
+            continue;
+        }
+        while(*c == '0' && isdigit((unsigned char) c[1]))
+            ++c;
+        const char *start = c;
+        while(isdigit((unsigned char) *c))
+            ++c;
+        key += '0';     // a number sorts where its first digit would
+        key += (char) min<size_t>(c - start, 255);
+        key.append(start, c - start);
+    }
+}
+
+static int type_rank_get(uint32_t mode)
+{
+    switch(mode & S_IFMT)
+    {
+        case S_IFDIR:   return 0;
+        case S_IFLNK:   return 1;
+        case S_IFREG:   return 2;
+        default:        return 3;
+    }
+}
+
+static void key_make(sort_key &key, const char *name, const content_rec &rec, int sort_mode)
+{
+    key.rank = !strcmp(name, ".") ? 0 : !strcmp(name, "..") ? 1 : 2;
+    key.num = 0;
+    key.text.clear();
+    bool stat_ok = rec.flags & CONTENT_STAT_OK;
+    switch(sort_mode)
+    {
+        case SORT_NATURAL:
+            natural_key_add(key.text, name);
+            return;
+
+        case SORT_SIZE:
+            key.num = (rec.flags & CONTENT_TOTAL) ? -rec.total : stat_ok ? -rec.size : 1;
+            break;
+
+        case SORT_MTIME:
+            key.num = stat_ok ? -rec.mtime : 1;
+            break;
+
+        case SORT_TYPE:
+            key.num = stat_ok ? type_rank_get(rec.mode) : 4;
+            break;
+
+        case SORT_EXTENSION:
+        {
+            const char *dot = strrchr(name, '.');
+            if(dot && dot != name)
+            {
+                key.num = 1;
+                collate_key_add(key.text, dot + 1);
+                key.text += '\0';       // "a.b" and "ab.c": the extension decides first
+            }
+            break;
+        }
+
+        default:
+            break;
+    }
+    collate_key_add(key.text, name);
+}
+
+/* sorts chunks of the keys on the pool, then merges them pairwise */
+static void keys_sort(vector<sort_key> &keys)
+{
+    work_pool &pool = pool_get();
+    if(keys.size() < SORT_PARALLEL_MIN || pool.size() < 2)
+    {
+        std::sort(keys.begin(), keys.end(), key_less);
+        return;
+    }
+
+    size_t n_chunks = pool.size() * 2;
+    vector<size_t> bounds;
+    for(size_t i = 0; i <= n_chunks; ++i)
+        bounds.pb(keys.size() * i / n_chunks);
+
+    work_group grp;
+    for(size_t i = 0; i + 1 < bounds.size(); ++i)
+    {
+        auto first = keys.begin() + bounds[i], last = keys.begin() + bounds[i + 1];
+        pool.submit(grp, [first, last] { std::sort(first, last, key_less); });
+    }
+    pool.wait(grp);
+
+    while(bounds.size() > 2)
+    {
+        vector<size_t> merged;
+        for(size_t i = 0; i + 1 < bounds.size(); i += 2)
+        {
+            merged.pb(bounds[i]);
+            if(i + 2 >= bounds.size())
+                break;
+            auto first = keys.begin() + bounds[i], middle = keys.begin() + bounds[i + 1];
+            auto last = keys.begin() + bounds[i + 2];
+            pool.submit(grp, [first, middle, last] { inplace_merge(first, middle, last, key_less); });
+        }
+        merged.pb(keys.size());
+        pool.wait(grp);
+        bounds.swap(merged);
+    }
+}
+
+void content_store::sort(int sort_mode)
+{
+    order = sort_mode;
+
+    /* the keys are made in chunks on the pool as well */
+    vector<sort_key> keys(recs.size());
+    const size_t chunk = 4096;
+    work_pool &pool = pool_get();
+    work_group grp;
+    for(size_t start = 0; start < recs.size(); start += chunk)
+    {
+        size_t end = min(start + chunk, recs.size());
+        auto make = [this, &keys, start, end, sort_mode]
+        {
+            for(size_t i = start; i < end; ++i)
+            {
+                key_make(keys[i], name(i), recs[i], sort_mode);
+                keys[i].pos = i;
+            }
+        };
+        if(recs.size() < SORT_PARALLEL_MIN)
+            make();
+        else
+            pool.submit(grp, make);
+    }
+    pool.wait(grp);
+
+    keys_sort(keys);
+
+    vector<content_rec> sorted;
+    sorted.reserve(recs.size());
+    for(auto &key : keys)
+        sorted.pb(recs[key.pos]);
+    recs.swap(sorted);
+}
+
+size_t content_store::sorted_pos(const scan_entry &entry) const
+{
+    content_rec rec;
+    rec.mode = entry.mode;
+    rec.size = entry.size;
+    rec.mtime = entry.mtime;
+    rec.flags = entry.stat_ok ? CONTENT_STAT_OK : 0;
+    rec.total = 0;
+
+    sort_key key, mid_key;
+    key_make(key, entry.name.c_str(), rec, order);
+    key.pos = recs.size();      // after its equals
+
+    size_t lo = 0, hi = recs.size();
+    while(lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        key_make(mid_key, name(mid), recs[mid], order);
+        mid_key.pos = mid;
+        if(key_less(mid_key, key))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* by name the rows are in name order; otherwise they have to be looked at */
+size_t content_store::find(const char *name_str) const
+{
+    if(order == SORT_NAME)
+    {
+        content_rec rec = {};
+        sort_key key, mid_key;
+        key_make(key, name_str, rec, order);
+        key.pos = 0;
+
+        size_t lo = 0, hi = recs.size();
+        while(lo < hi)
+        {
+            size_t mid = lo + (hi - lo) / 2;
+            key_make(mid_key, name(mid), recs[mid], order);
+            mid_key.pos = 0;
+            if(key_less(mid_key, key))
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        return (lo < recs.size() && !strcmp(name(lo), name_str)) ? lo : recs.size();
+    }
+
+    for(size_t pos = 0; pos < recs.size(); ++pos)
+    {
+        if(!strcmp(name(pos), name_str))
+            return pos;
+    }
+    return recs.size();
+}
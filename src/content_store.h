@@ -0,0 +1,102 @@
+#ifndef _CONTENT_STORE_H_
+#define _CONTENT_STORE_H_
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+struct scan_entry;
+
+/* fixed-size record of one row of the listing. Names and paths are kept
+ * NUL terminated in the arena of the store.
+ */
+struct content_rec
+{
+    uint32_t  name_off;
+    uint32_t  name_len;
+    uint32_t  path_off;         // text rows only: the path they stand for
+    uint32_t  path_len;
+    uint32_t  mode;
+    uint32_t  uid;
+    uint32_t  gid;
+    uint8_t   flags;            // CONTENT_*
+    int64_t   size;
+    int64_t   mtime;
+    int64_t   total;            // recursive allocated size of a directory, with CONTENT_TOTAL
+};
+
+#define CONTENT_STAT_OK     0x1     // the attributes are known
+#define CONTENT_TEXT        0x2     // a line of text (search result, stats), the name is what is shown
+#define CONTENT_TOTAL       0x4     // total holds the size of everything below the directory
+
+/* orders of the directory rows; "." and ".." always stay on top */
+#define SORT_NAME           0       // like alphasort
+#define SORT_NATURAL        1       // digit runs compare by value, as ls -v
+#define SORT_SIZE           2       // largest first, directories by their total once known
+#define SORT_MTIME          3       // newest first
+#define SORT_TYPE           4       // directories, links, files, then the rest
+#define SORT_EXTENSION      5       // by what follows the last '.', names without one first
+#define SORT_MODES          6
+
+#define SORT_PARALLEL_MIN   (64 * 1024)     // rows below which one thread sorts
+
+/* the rows on the screen's list: an array of content_rec plus one arena
+ * for their strings, addressed by position. Display lines are not stored,
+ * they are built for the rows being drawn.
+ */
+class content_store
+{
+public:
+    content_store(): n_dead(0), order(SORT_NAME) {}
+
+    size_t size() const { return recs.size(); }
+    bool   empty() const { return recs.empty(); }
+    void   clear();
+    void   swap(content_store &other);
+    void   reserve(size_t n_rows, size_t n_bytes);
+
+    void   entry_add(const scan_entry &entry);
+    void   entry_insert(size_t pos, const scan_entry &entry);
+    void   entry_set(size_t pos, const scan_entry &entry);
+    void   text_add(const std::string &text, const std::string &path = "");
+    void   erase(size_t pos);
+
+    /* the pointers stay valid until the store is next modified */
+    const char* name(size_t pos) const { return arena.data() + recs[pos].name_off; }
+    const char* path(size_t pos) const { return arena.data() + recs[pos].path_off; }
+    bool        is_text(size_t pos) const { return recs[pos].flags & CONTENT_TEXT; }
+    void        entry_get(size_t pos, scan_entry &entry) const;
+
+    /* recursive sizes of directory rows; a row whose attributes are set
+     * again loses its total
+     */
+    void        total_set(size_t pos, int64_t bytes);
+    bool        has_total(size_t pos) const { return recs[pos].flags & CONTENT_TOTAL; }
+    int64_t     total(size_t pos) const { return recs[pos].total; }
+    void        totals_clear();
+
+    /* sorts the directory rows once their keys are made, in parallel on
+     * the work pool for large listings; the strings stay where they are
+     */
+    void   sort(int sort_mode);
+    int    sort_mode() const { return order; }
+
+    /* where entry belongs in the current order, and the row of a name
+     * (size() if not listed)
+     */
+    size_t sorted_pos(const scan_entry &entry) const;
+    size_t find(const char *name) const;
+
+private:
+    uint32_t str_add(const char *str, size_t len);
+    void     rec_fill(content_rec &rec, const scan_entry &entry);
+    void     arena_compact();
+
+    std::vector<content_rec>  recs;
+    std::vector<char>         arena;
+    size_t                    n_dead;       // arena bytes of erased rows
+    int                       order;        // SORT_* the rows are in
+};
+
+#endif
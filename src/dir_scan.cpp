@@ -0,0 +1,156 @@
+#include "dir_scan.h"
+#include "thread_pool.h"
+#include "stats.h"
+#include "common.h"
+#include "includes.h"
+
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <algorithm>
+
+using namespace std;
+
+/* record layout of the getdents64 system call */
+struct linux_dirent64
+{
+    ino64_t         d_ino;
+    off64_t         d_off;
+    unsigned short  d_reclen;
+    unsigned char   d_type;
+    char            d_name[];
+};
+
+dirent_stream::dirent_stream(int fd, size_t buf_size): dir_fd(fd), buf(buf_size), buf_pos(0), buf_len(0), err(0)
+{
+}
+
+bool dirent_stream::next(const char *&name, unsigned char &type, ino_t &ino)
+{
+    while(1)
+    {
+        if(buf_pos >= buf_len)
+        {
+            buf_len = syscall(SYS_getdents64, dir_fd, buf.data(), buf.size());
+            buf_pos = 0;
+            if(buf_len <= 0)
+            {
+                if(buf_len < 0)
+                    err = errno;
+                buf_len = 0;
+                return false;
+            }
+        }
+
+        linux_dirent64 *de = (linux_dirent64 *) (buf.data() + buf_pos);
+        buf_pos += de->d_reclen;
+
+        if(de->d_name[0] == '.' && (de->d_name[1] == '\0' || (de->d_name[1] == '.' && de->d_name[2] == '\0')))
+            continue;
+
+        name = de->d_name;
+        type = de->d_type;
+        ino = de->d_ino;
+        return true;
+    }
+}
+
+/* fills in the attributes of one entry with a statx() relative to the
+ * directory, asking only for the fields the listing shows
+ */
+static void entry_stat(int dir_fd, scan_entry &entry)
+{
+    stat_scope sc(STAT_ENTRY_STAT);
+    const unsigned int mask = STATX_TYPE | STATX_MODE | STATX_UID | STATX_GID | STATX_SIZE | STATX_MTIME;
+    struct statx stx;
+
+    int ret = statx(dir_fd, entry.name.c_str(), AT_STATX_DONT_SYNC, mask, &stx);
+    if(FAILURE == ret)      // dangling symlink, show the link itself
+        ret = statx(dir_fd, entry.name.c_str(), AT_STATX_DONT_SYNC | AT_SYMLINK_NOFOLLOW, mask, &stx);
+
+    entry.stat_ok = (SUCCESS == ret);
+    if(!entry.stat_ok)
+        return;
+
+    entry.mode = stx.stx_mode;
+    entry.uid = stx.stx_uid;
+    entry.gid = stx.stx_gid;
+    entry.size = stx.stx_size;
+    entry.mtime = stx.stx_mtime.tv_sec;
+}
+
+/* reads the directory dir_path with getdents64 and stats every entry
+ * relative to the directory fd. Entries come in directory order, with
+ * "." and ".." first; ordering them is up to the caller.
+ */
+int dir_scan(const string &dir_path, vector<scan_entry> &entries, int flags)
+{
+    stat_scope sc(STAT_DIR_SCAN);
+    int dir_fd = open(dir_path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(FAILURE == dir_fd)
+        return FAILURE;
+
+    entries.clear();
+    if(flags & SCAN_DOTS)
+    {
+        entries.resize(2);
+        entries[0].name = ".";
+        entries[1].name = "..";
+    }
+
+    dirent_stream ds(dir_fd, 1024 * 1024);
+    const char *name;
+    unsigned char type;
+    ino_t ino;
+    while(ds.next(name, type, ino))
+    {
+        if(name[0] == '.' && !(flags & SCAN_HIDDEN))
+            continue;
+        entries.emplace_back();
+        entries.back().name = name;
+    }
+    if(ds.error())
+    {
+        close(dir_fd);
+        errno = ds.error();
+        return FAILURE;
+    }
+
+    /* below a few thousand entries handing out the work costs more than it saves */
+    const size_t chunk = 1024;
+    work_pool &pool = pool_get();
+    if((flags & SCAN_POOL) && entries.size() > 4 * chunk && pool.size() > 1)
+    {
+        work_group grp;
+        for(size_t start = 0; start < entries.size(); start += chunk)
+        {
+            size_t end = min(start + chunk, entries.size());
+            pool.submit(grp, [dir_fd, &entries, start, end]
+            {
+                for(size_t i = start; i < end; ++i)
+                    entry_stat(dir_fd, entries[i]);
+            });
+        }
+        pool.wait(grp);
+    }
+    else
+    {
+        for(auto &entry : entries)
+            entry_stat(dir_fd, entry);
+    }
+
+    close(dir_fd);
+    return SUCCESS;
+}
+
+/* the attributes of a single entry of dir_path */
+int dir_entry_scan(const string &dir_path, const string &name, scan_entry &entry)
+{
+    int dir_fd = open(dir_path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(FAILURE == dir_fd)
+        return FAILURE;
+
+    entry.name = name;
+    entry_stat(dir_fd, entry);
+    close(dir_fd);
+    return entry.stat_ok ? SUCCESS : FAILURE;
+}
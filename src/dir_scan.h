@@ -0,0 +1,47 @@
+#ifndef _DIR_SCAN_H_
+#define _DIR_SCAN_H_
+
+#include <sys/types.h>
+#include <string>
+#include <vector>
+
+#define SCAN_DOTS      0x1      // report "." and ".."
+#define SCAN_HIDDEN    0x2      // report the other names starting with '.'
+#define SCAN_POOL      0x4      // fan the stats out over the work pool
+
+/* reads the entries of an open directory straight from getdents64 in large
+ * batches, skipping "." and "..". The name pointers stay valid until the
+ * next call to next().
+ */
+class dirent_stream
+{
+public:
+    explicit dirent_stream(int dir_fd, size_t buf_size = 64 * 1024);
+
+    bool next(const char *&name, unsigned char &type, ino_t &ino);
+    int  error() const { return err; }
+
+private:
+    int                dir_fd;
+    std::vector<char>  buf;
+    long               buf_pos;
+    long               buf_len;
+    int                err;
+};
+
+/* the attributes of a directory entry the listing shows */
+struct scan_entry
+{
+    std::string  name;
+    mode_t       mode;
+    uid_t        uid;
+    gid_t        gid;
+    off_t        size;
+    time_t       mtime;
+    bool         stat_ok;
+};
+
+int dir_scan(const std::string &dir_path, std::vector<scan_entry> &entries, int flags);
+int dir_entry_scan(const std::string &dir_path, const std::string &name, scan_entry &entry);
+
+#endif
@@ -0,0 +1,250 @@
+#include "dir_size.h"
+#include "dir_scan.h"
+#include "thread_pool.h"
+#include "common.h"
+#include "includes.h"
+
+#include <atomic>
+#include <fcntl.h>
+#include <mutex>
+#include <sys/eventfd.h>
+#include <thread>
+#include <unordered_map>
+
+using namespace std;
+
+/* what a directory holds apart from its sub-directories, valid while its
+ * mtime stays the same
+ */
+struct cached_dir
+{
+    dev_t            dev;
+    ino_t            ino;
+    struct timespec  mtime;
+    uint64_t         own_bytes;     // the directory itself and its other entries
+    vector<string>   subdirs;
+};
+
+static mutex                               cache_lock;
+static unordered_map<string, cached_dir>   cache;
+
+/* a directory being summed up. It hands its total to its parent once the
+ * last of its sub-directories has reported.
+ */
+struct size_node
+{
+    size_node          *parent;
+    int                 top;        // index into the names, -1 below them
+    atomic<uint64_t>    bytes;
+    atomic<int>         pending;    // sub-directories still out, +1 while reading
+
+    size_node(size_node *p, int t): parent(p), top(t), bytes(0), pending(1) {}
+};
+
+struct size_ctx
+{
+    vector<string>           names;
+    work_group               grp;
+    atomic<bool>             cancelled;
+    atomic<bool>             done;
+    atomic<bool>             notified;
+    mutex                    result_lock;
+    vector<dir_size_result>  results;
+};
+
+static size_ctx  *sizing;
+static thread     size_driver;
+static int        size_event_fd = FAILURE;
+
+static void size_notify(size_ctx &ctx)
+{
+    if(!ctx.notified.exchange(true))
+    {
+        uint64_t one = 1;
+        if(write(size_event_fd, &one, sizeof(one)) < 0)
+            ctx.notified = false;
+    }
+}
+
+static void size_node_release(size_ctx &ctx, size_node *node)
+{
+    while(0 == --node->pending)
+    {
+        size_node *parent = node->parent;
+        if(node->top >= 0)
+        {
+            if(!ctx.cancelled)
+            {
+                lock_guard<mutex> lk(ctx.result_lock);
+                ctx.results.pb({ctx.names[node->top], node->bytes});
+            }
+            size_notify(ctx);
+        }
+        else
+        {
+            parent->bytes += node->bytes;
+        }
+        delete node;
+        if(!parent)
+            return;
+        node = parent;
+    }
+}
+
+/* reads a directory missing from the cache, or changed since */
+static bool dir_read(const string &path, cached_dir &cd)
+{
+    int dir_fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if(FAILURE == dir_fd)
+        return false;
+
+    struct stat dir_stat;
+    if(FAILURE == fstat(dir_fd, &dir_stat))
+    {
+        close(dir_fd);
+        return false;
+    }
+    cd.dev = dir_stat.st_dev;
+    cd.ino = dir_stat.st_ino;
+    cd.mtime = dir_stat.st_mtim;
+    cd.own_bytes = dir_stat.st_blocks * 512ULL;
+
+    dirent_stream ds(dir_fd);
+    const char *name;
+    unsigned char type;
+    ino_t ino;
+    while(ds.next(name, type, ino))
+    {
+        struct stat entry_stat;
+        if(FAILURE == fstatat(dir_fd, name, &entry_stat, AT_SYMLINK_NOFOLLOW))
+            continue;
+        if(S_ISDIR(entry_stat.st_mode))
+            cd.subdirs.pb(name);
+        else
+            cd.own_bytes += entry_stat.st_blocks * 512ULL;
+    }
+    close(dir_fd);
+    return true;
+}
+
+static void dir_size_task(size_ctx &ctx, size_node *node, const string &path)
+{
+    if(ctx.cancelled)
+    {
+        size_node_release(ctx, node);
+        return;
+    }
+
+    /* one stat() tells whether what was read last time still holds */
+    cached_dir cd;
+    struct stat dir_stat;
+    bool cached = false;
+    if(SUCCESS == lstat(path.c_str(), &dir_stat))
+    {
+        lock_guard<mutex> lk(cache_lock);
+        auto itr = cache.find(path);
+        if(itr != cache.end() && itr->second.dev == dir_stat.st_dev && itr->second.ino == dir_stat.st_ino &&
+           itr->second.mtime.tv_sec == dir_stat.st_mtim.tv_sec && itr->second.mtime.tv_nsec == dir_stat.st_mtim.tv_nsec)
+        {
+            cd = itr->second;
+            cached = true;
+        }
+    }
+    if(!cached)
+    {
+        if(!dir_read(path, cd))
+        {
+            size_node_release(ctx, node);
+            return;
+        }
+        lock_guard<mutex> lk(cache_lock);
+        if(cache.size() >= DIR_SIZE_CACHE_MAX)
+            cache.clear();
+        cache[path] = cd;
+    }
+
+    node->bytes += cd.own_bytes;
+    work_pool &pool = pool_get();
+    for(auto &subdir : cd.subdirs)
+    {
+        size_node *child = new size_node(node, -1);
+        ++node->pending;
+        string child_path = path + "/" + subdir;
+        pool.submit(ctx.grp, [&ctx, child, child_path] { dir_size_task(ctx, child, child_path); });
+    }
+    size_node_release(ctx, node);
+}
+
+void dir_size_start(const string &dir_path, const vector<string> &names)
+{
+    dir_size_cancel();
+
+    if(FAILURE == size_event_fd)
+        size_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    size_ctx *ctx = new size_ctx;
+    ctx->names = names;
+    ctx->cancelled = ctx->done = ctx->notified = false;
+
+    string root = dir_path;
+    while(root.length() > 1 && root[root.length() - 1] == '/')
+        root.erase(root.length() - 1);
+    if(root == "/")
+        root.clear();
+
+    sizing = ctx;
+    size_driver = thread([ctx, root]
+    {
+        work_pool &pool = pool_get();
+        for(unsigned int i = 0; i < ctx->names.size(); ++i)
+        {
+            size_node *node = new size_node(NULL, i);
+            string path = root + "/" + ctx->names[i];
+            pool.submit(ctx->grp, [ctx, node, path] { dir_size_task(*ctx, node, path); });
+        }
+        pool.wait(ctx->grp);
+        ctx->done = true;
+        size_notify(*ctx);
+    });
+}
+
+int dir_size_fd()
+{
+    if(FAILURE == size_event_fd)
+        size_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    return size_event_fd;
+}
+
+/* moves the totals found so far into results, returns true while the
+ * computation is still running
+ */
+bool dir_size_drain(vector<dir_size_result> &results)
+{
+    if(!sizing)
+        return false;
+
+    uint64_t count;
+    if(read(size_event_fd, &count, sizeof(count)) > 0)
+        sizing->notified = false;
+
+    bool running = !sizing->done;
+    lock_guard<mutex> lk(sizing->result_lock);
+    for(auto &result : sizing->results)
+        results.pb(move(result));
+    sizing->results.clear();
+    return running;
+}
+
+void dir_size_cancel()
+{
+    if(!sizing)
+        return;
+
+    sizing->cancelled = true;
+    size_driver.join();
+    delete sizing;
+    sizing = NULL;
+
+    uint64_t count;
+    while(read(size_event_fd, &count, sizeof(count)) > 0);
+}
@@ -0,0 +1,27 @@
+#ifndef _DIR_SIZE_H_
+#define _DIR_SIZE_H_
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#define DIR_SIZE_CACHE_MAX  (1 << 20)      // directories remembered before the cache starts over
+
+struct dir_size_result
+{
+    std::string  name;
+    uint64_t     bytes;         // allocated, st_blocks * 512, of everything below
+};
+
+/* computes the recursive allocated size of the sub-directories names of
+ * dir_path on the work pool, one directory per task; dir_size_fd() becomes
+ * readable as totals come in. Every directory read is remembered with its
+ * mtime, so walking an unchanged subtree again only stats its directories.
+ * Only one computation runs at a time, starting one cancels the previous.
+ */
+void dir_size_start(const std::string &dir_path, const std::vector<std::string> &names);
+int  dir_size_fd();
+bool dir_size_drain(std::vector<dir_size_result> &results);
+void dir_size_cancel();
+
+#endif
@@ -0,0 +1,110 @@
+#include "dir_watch.h"
+#include "common.h"
+#include "includes.h"
+
+#include <sys/inotify.h>
+
+using namespace std;
+
+static int     watch_fd = FAILURE;
+static int     watch_wd = FAILURE;
+static string  watch_path;
+
+int dir_watch_start(const string &dir_path)
+{
+    if(watch_wd != FAILURE && dir_path == watch_path)
+        return SUCCESS;
+    dir_watch_stop();
+
+    if(FAILURE == watch_fd)
+        watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(FAILURE == watch_fd)
+        return FAILURE;
+
+    watch_wd = inotify_add_watch(watch_fd, dir_path.c_str(),
+                                 IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB |
+                                 IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+    if(FAILURE == watch_wd)
+        return FAILURE;
+
+    watch_path = dir_path;
+    return SUCCESS;
+}
+
+void dir_watch_stop()
+{
+    if(watch_wd != FAILURE)
+        inotify_rm_watch(watch_fd, watch_wd);
+    watch_wd = FAILURE;
+    watch_path.clear();
+
+    /* drop what the old directory still had queued */
+    char buf[4096];
+    while(watch_fd != FAILURE && read(watch_fd, buf, sizeof(buf)) > 0);
+}
+
+bool dir_watch_active()
+{
+    return watch_wd != FAILURE;
+}
+
+int dir_watch_fd()
+{
+    return watch_fd;
+}
+
+/* reads every pending event, a burst on the same name becomes one event */
+void dir_watch_events_get(vector<dir_event> &events)
+{
+    alignas(struct inotify_event) char buf[64 * 1024];
+    ssize_t len;
+
+    events.clear();
+    while((len = read(watch_fd, buf, sizeof(buf))) > 0)
+    {
+        for(char *p = buf; p < buf + len; )
+        {
+            struct inotify_event *ev = (struct inotify_event *) p;
+            p += sizeof(struct inotify_event) + ev->len;
+
+            int kind;
+            if(ev->mask & IN_Q_OVERFLOW)
+                kind = DIR_EVENT_RESCAN;
+            else if(ev->wd != watch_wd)     // left over from a directory no longer watched
+                continue;
+            else if(ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))
+            {
+                /* the watch is gone with the directory, a new start re-adds it */
+                watch_wd = FAILURE;
+                watch_path.clear();
+                kind = DIR_EVENT_RESCAN;
+            }
+            else if(!ev->len)
+                continue;
+            else if(ev->mask & (IN_CREATE | IN_MOVED_TO))
+                kind = DIR_EVENT_ADD;
+            else if(ev->mask & (IN_DELETE | IN_MOVED_FROM))
+                kind = DIR_EVENT_REMOVE;
+            else
+                kind = DIR_EVENT_CHANGE;
+
+            if(kind == DIR_EVENT_RESCAN)
+            {
+                events.assign(1, {"", DIR_EVENT_RESCAN});
+                continue;
+            }
+            if(!events.empty() && events.back().kind == DIR_EVENT_RESCAN)
+                continue;
+
+            string name(ev->name);
+            if(!events.empty() && events.back().name == name)
+            {
+                /* create + write is still an add, anything + delete a remove */
+                if(!(events.back().kind == DIR_EVENT_ADD && kind == DIR_EVENT_CHANGE))
+                    events.back().kind = kind;
+                continue;
+            }
+            events.pb({name, kind});
+        }
+    }
+}
@@ -0,0 +1,27 @@
+#ifndef _DIR_WATCH_H_
+#define _DIR_WATCH_H_
+
+#include <string>
+#include <vector>
+
+#define DIR_EVENT_ADD       0       // name appeared (created, moved in)
+#define DIR_EVENT_REMOVE    1       // name disappeared (deleted, moved out)
+#define DIR_EVENT_CHANGE    2       // attributes or contents changed
+#define DIR_EVENT_RESCAN    3       // events were lost or the directory itself went away
+
+struct dir_event
+{
+    std::string  name;
+    int          kind;
+};
+
+/* inotify watch on one directory, used to keep the listing current without
+ * rescanning it. dir_watch_fd() is readable when events are pending.
+ */
+int  dir_watch_start(const std::string &dir_path);
+void dir_watch_stop();
+bool dir_watch_active();
+int  dir_watch_fd();
+void dir_watch_events_get(std::vector<dir_event> &events);
+
+#endif
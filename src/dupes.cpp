@@ -0,0 +1,302 @@
+#include "dupes.h"
+#include "dir_scan.h"
+#include "hash.h"
+#include "stats.h"
+#include "thread_pool.h"
+#include "common.h"
+#include "includes.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <fcntl.h>
+#include <functional>
+#include <mutex>
+#include <tuple>
+
+using namespace std;
+
+struct dupe_file
+{
+    string    path;
+    off_t     size;
+    dev_t     dev;
+    ino_t     ino;
+    uint64_t  edge_hash;
+    uint64_t  full_hash;
+    bool      ok;           // cleared when the file could not be read
+};
+
+struct dupes_ctx
+{
+    work_group         grp;
+    mutex              file_lock;
+    vector<dupe_file>  files;
+    op_ctl            *ctl;
+};
+
+static void dir_collect_task(dupes_ctx &ctx, const string &dir_path)
+{
+    if(ctx.ctl && !ctx.ctl->proceed())
+        return;
+
+    int dir_fd = open(dir_path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(FAILURE == dir_fd)
+        return;
+
+    vector<dupe_file> found;
+    work_pool &pool = pool_get();
+    dirent_stream ds(dir_fd);
+    const char *name;
+    unsigned char type;
+    ino_t ino;
+    while(ds.next(name, type, ino))
+    {
+        if(type != DT_REG && type != DT_DIR && type != DT_UNKNOWN)
+            continue;
+
+        string path = (dir_path == "/" ? "" : dir_path) + "/" + name;
+        struct stat entry_stat;
+        if(type == DT_DIR)
+        {
+            pool.submit(ctx.grp, [&ctx, path] { dir_collect_task(ctx, path); });
+            continue;
+        }
+        if(FAILURE == fstatat(dir_fd, name, &entry_stat, AT_SYMLINK_NOFOLLOW))
+            continue;
+        if(S_ISDIR(entry_stat.st_mode))
+            pool.submit(ctx.grp, [&ctx, path] { dir_collect_task(ctx, path); });
+        else if(S_ISREG(entry_stat.st_mode) && entry_stat.st_size > 0)
+            found.pb({path, entry_stat.st_size, entry_stat.st_dev, entry_stat.st_ino, 0, 0, true});
+    }
+    close(dir_fd);
+
+    if(ctx.ctl)
+        ctx.ctl->files_done += found.size();
+    if(!found.empty())
+    {
+        lock_guard<mutex> lk(ctx.file_lock);
+        for(auto &file : found)
+            ctx.files.pb(move(file));
+    }
+}
+
+static bool pread_full(int fd, char *buf, size_t len, off_t off)
+{
+    while(len)
+    {
+        ssize_t n = pread(fd, buf, len, off);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return false;
+        buf += n;
+        len -= n;
+        off += n;
+    }
+    return true;
+}
+
+/* hashes the first and last DUPES_EDGE_SIZE bytes; a file no longer than
+ * that twice is hashed whole, which then stands for its full hash as well
+ */
+static void edge_hash_task(dupe_file &file, op_ctl *ctl)
+{
+    if(ctl && !ctl->proceed())
+    {
+        file.ok = false;
+        return;
+    }
+
+    int fd = open(file.path.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if(FAILURE == fd)
+    {
+        file.ok = false;
+        return;
+    }
+
+    char buf[2 * DUPES_EDGE_SIZE];
+    size_t len = min((off_t) sizeof(buf), file.size);
+    if(file.size <= (off_t) sizeof(buf))
+        file.ok = pread_full(fd, buf, len, 0);
+    else
+        file.ok = pread_full(fd, buf, DUPES_EDGE_SIZE, 0) &&
+                  pread_full(fd, buf + DUPES_EDGE_SIZE, DUPES_EDGE_SIZE, file.size - DUPES_EDGE_SIZE);
+    close(fd);
+
+    if(file.ok)
+        file.edge_hash = file.full_hash = xxh64(buf, len);
+    if(ctl)
+        ctl->bytes_done += len;
+}
+
+/* reads the file in DUPES_READ_SIZE blocks rather than mapping it: a file
+ * truncated meanwhile by another process is then only a short read, not
+ * a SIGBUS
+ */
+static void full_hash_task(dupe_file &file, op_ctl *ctl)
+{
+    stat_scope sc(STAT_DUPES_HASH);
+
+    int fd = open(file.path.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if(FAILURE == fd)
+    {
+        file.ok = false;
+        return;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    vector<char> buf(min(file.size, (off_t) DUPES_READ_SIZE));
+    xxh64_state state;
+    for(off_t off = 0; off < file.size && file.ok; off += buf.size())
+    {
+        if(ctl && !ctl->proceed())
+        {
+            file.ok = false;
+            break;
+        }
+        size_t len = min((off_t) buf.size(), file.size - off);
+        file.ok = pread_full(fd, buf.data(), len, off);     // false once gone short
+        state.update(buf.data(), len);
+        if(ctl)
+            ctl->bytes_done += len;
+    }
+    close(fd);
+    file.full_hash = state.digest();
+    sc.bytes_add(file.size);
+}
+
+/* runs fn on every file of idx on the pool */
+template<typename F>
+static void hash_round(vector<dupe_file> &files, const vector<size_t> &idx, op_ctl *ctl, F fn)
+{
+    work_pool &pool = pool_get();
+    work_group grp;
+    for(size_t i : idx)
+        pool.submit(grp, [&files, i, ctl, fn] { fn(files[i], ctl); });
+    pool.wait(grp);
+}
+
+/* sorts idx by key and calls fn on each run of two or more equal keys */
+template<typename K, typename F>
+static void runs_for_each(vector<dupe_file> &files, vector<size_t> &idx, K key, F fn)
+{
+    sort(idx.begin(), idx.end(), [&](size_t a, size_t b) { return key(files[a]) < key(files[b]); });
+    for(size_t begin = 0, end; begin < idx.size(); begin = end)
+    {
+        for(end = begin + 1; end < idx.size() && key(files[idx[end]]) == key(files[idx[begin]]); ++end);
+        if(end - begin > 1)
+            fn(idx.begin() + begin, idx.begin() + end);
+    }
+}
+
+static bool dupes_cancelled(op_ctl *ctl, string &err_msg)
+{
+    if(!ctl || !ctl->cancelled)
+        return false;
+    err_msg = "Cancelled";
+    return true;
+}
+
+int dupes_find(const string &root_path, vector<dupe_group> &groups, dupe_stats &stats, string &err_msg,
+               op_ctl *ctl)
+{
+    string root = root_path;
+    while(root.length() > 1 && root[root.length() - 1] == '/')
+        root.erase(root.length() - 1);
+
+    if(FAILURE == access(root.c_str(), R_OK | X_OK))
+    {
+        err_msg = "Failed to read " + root + " : " + strerror(errno);
+        return FAILURE;
+    }
+
+    dupes_ctx ctx;
+    ctx.ctl = ctl;
+    work_pool &pool = pool_get();
+    pool.submit(ctx.grp, [&ctx, root] { dir_collect_task(ctx, root); });
+    pool.wait(ctx.grp);
+    if(dupes_cancelled(ctl, err_msg))
+        return FAILURE;
+
+    vector<dupe_file> &files = ctx.files;
+    stats = dupe_stats();
+    stats.n_files = files.size();
+
+    /* hard links are the same file, not duplicates */
+    sort(files.begin(), files.end(), [](const dupe_file &a, const dupe_file &b)
+    {
+        return make_tuple(a.dev, a.ino, cref(a.path)) < make_tuple(b.dev, b.ino, cref(b.path));
+    });
+    files.erase(unique(files.begin(), files.end(), [](const dupe_file &a, const dupe_file &b)
+    {
+        return a.dev == b.dev && a.ino == b.ino;
+    }), files.end());
+
+    vector<size_t> all(files.size()), same_size;
+    for(size_t i = 0; i < files.size(); ++i)
+        all[i] = i;
+    runs_for_each(files, all, [](const dupe_file &f) { return f.size; },
+                  [&](vector<size_t>::iterator b, vector<size_t>::iterator e) { same_size.insert(same_size.end(), b, e); });
+
+    /* the walk is over: from here on the progress is in bytes hashed */
+    if(ctl)
+    {
+        ctl->files_total = ctl->files_done.load();
+        for(size_t i : same_size)
+            ctl->bytes_total += min(files[i].size, (off_t) (2 * DUPES_EDGE_SIZE));
+    }
+    stats.n_edge_hashed = same_size.size();
+    hash_round(files, same_size, ctl, edge_hash_task);
+    if(dupes_cancelled(ctl, err_msg))
+        return FAILURE;
+
+    /* small files were hashed whole already */
+    vector<size_t> same_edge, confirmed;
+    runs_for_each(files, same_size, [](const dupe_file &f) { return make_tuple(f.ok, f.size, f.edge_hash); },
+                  [&](vector<size_t>::iterator b, vector<size_t>::iterator e)
+    {
+        if(!files[*b].ok)
+            return;
+        if(files[*b].size <= 2 * DUPES_EDGE_SIZE)
+            confirmed.insert(confirmed.end(), b, e);
+        else
+            same_edge.insert(same_edge.end(), b, e);
+    });
+
+    if(ctl)
+    {
+        for(size_t i : same_edge)
+            ctl->bytes_total += files[i].size;
+    }
+    stats.n_full_hashed = same_edge.size();
+    hash_round(files, same_edge, ctl, full_hash_task);
+    if(dupes_cancelled(ctl, err_msg))
+        return FAILURE;
+    confirmed.insert(confirmed.end(), same_edge.begin(), same_edge.end());
+
+    for(auto &file : files)
+        if(!file.ok)
+            ++stats.n_unreadable;
+
+    runs_for_each(files, confirmed, [](const dupe_file &f) { return make_tuple(f.ok, f.size, f.full_hash); },
+                  [&](vector<size_t>::iterator b, vector<size_t>::iterator e)
+    {
+        if(!files[*b].ok)
+            return;
+        dupe_group group;
+        group.size = files[*b].size;
+        for(auto it = b; it != e; ++it)
+            group.paths.pb(files[*it].path);
+        sort(group.paths.begin(), group.paths.end());
+        groups.pb(move(group));
+    });
+
+    sort(groups.begin(), groups.end(), [](const dupe_group &a, const dupe_group &b)
+    {
+        off_t wasted_a = a.size * (a.paths.size() - 1), wasted_b = b.size * (b.paths.size() - 1);
+        if(wasted_a != wasted_b)
+            return wasted_a > wasted_b;
+        return a.paths[0] < b.paths[0];
+    });
+    return SUCCESS;
+}
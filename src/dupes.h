@@ -0,0 +1,39 @@
+#ifndef _DUPES_H_
+#define _DUPES_H_
+
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+#include "file_ops.h"
+
+#define DUPES_EDGE_SIZE     4096        // bytes hashed at each end of a file before the full hash
+#define DUPES_READ_SIZE     (1 << 20)   // bytes per read of the full hash
+
+/* files of the same size whose contents hash the same */
+struct dupe_group
+{
+    off_t                     size;
+    std::vector<std::string>  paths;   // sorted, hard links to one file listed once
+};
+
+struct dupe_stats
+{
+    unsigned long  n_files;            // regular non-empty files seen
+    unsigned long  n_edge_hashed;      // files sharing their size with another
+    unsigned long  n_full_hashed;      // files sharing size and edge hash too
+    unsigned long  n_unreadable;       // candidates that could not be opened or read
+};
+
+/* finds duplicate files below root_path in three rounds, each only over
+ * what the previous one left: group by size, hash the first and last
+ * DUPES_EDGE_SIZE bytes, then hash the whole file. The walk
+ * and every hash run as tasks on the work pool; symbolic links are not
+ * followed. Groups come sorted by the space they waste, largest first.
+ * With a ctl the walk counts files_done and the hashing bytes, and a
+ * cancel fails it with "Cancelled", within DUPES_READ_SIZE of a large file.
+ */
+int dupes_find(const std::string &root_path, std::vector<dupe_group> &groups, dupe_stats &stats,
+               std::string &err_msg, op_ctl *ctl = NULL);
+
+#endif
@@ -0,0 +1,825 @@
+#include "file_ops.h"
+#include "dir_scan.h"
+#include "hash.h"
+#include "thread_pool.h"
+#include "stats.h"
+#include "common.h"
+#include "includes.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/sendfile.h>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+bool op_ctl::proceed()
+{
+    if(paused)
+    {
+        unique_lock<mutex> lk(pause_lock);
+        pause_cv.wait(lk, [this] { return !paused || cancelled; });
+    }
+    return !cancelled;
+}
+
+void op_ctl::pause(bool on)
+{
+    {
+        lock_guard<mutex> lk(pause_lock);
+        paused = on;
+    }
+    pause_cv.notify_all();
+}
+
+void op_ctl::cancel()
+{
+    {
+        lock_guard<mutex> lk(pause_lock);
+        cancelled = true;
+    }
+    pause_cv.notify_all();
+}
+
+struct copied_dir
+{
+    string src_path;
+    string dest_path;
+    mode_t mode;
+};
+
+/* state of one tree copy, shared by the walking thread and the workers */
+struct copy_ctx
+{
+    work_group           grp;
+    mutex                err_lock;
+    string               err_msg;
+    vector<copied_dir>   dirs;          // created directories, in creation order
+    bool                 remove_src;    // unlink every source file once it is copied
+    op_ctl              *ctl;
+    copy_verify         *verify;
+};
+
+static void copy_error_set(copy_ctx &ctx, const string &msg)
+{
+    lock_guard<mutex> lk(ctx.err_lock);
+    if(ctx.err_msg.empty())
+        ctx.err_msg = msg;
+}
+
+/* kernel side transfer of size bytes from in_fd to out_fd: a reflink where
+ * the filesystem supports it, then copy_file_range(), then sendfile().
+ * Returns FAILURE with errno set when none of them can handle the pair.
+ * With a ctl the data moves in OP_CHUNK_SIZE steps, so that a pause or a
+ * cancel (ECANCELED) takes effect within a large file.
+ */
+static int fd_data_copy(int in_fd, int out_fd, off_t size, op_ctl *ctl)
+{
+    if(SUCCESS == ioctl(out_fd, FICLONE, in_fd))
+    {
+        if(ctl)
+            ctl->bytes_done += size;
+        return SUCCESS;
+    }
+
+    off_t copied = 0;
+    bool range_ok = true;
+    while(copied < size)
+    {
+        if(ctl && !ctl->proceed())
+        {
+            errno = ECANCELED;
+            return FAILURE;
+        }
+
+        size_t len = size - copied;
+        if(ctl && len > OP_CHUNK_SIZE)
+            len = OP_CHUNK_SIZE;
+        ssize_t n = range_ok ? copy_file_range(in_fd, NULL, out_fd, NULL, len, 0)
+                             : sendfile(out_fd, in_fd, NULL, len);
+        if(n > 0)
+        {
+            copied += n;
+            if(ctl)
+                ctl->bytes_done += n;
+            continue;
+        }
+        if(n == 0)              // source shrunk under us
+            break;
+        if(errno == EINTR)
+            continue;
+
+        /* nothing was transferred yet: cross-filesystem copy_file_range on
+         * older kernels, or files the call does not support
+         */
+        if(range_ok && copied == 0 && (errno == EXDEV || errno == ENOSYS || errno == EINVAL ||
+                                       errno == EOPNOTSUPP || errno == EPERM))
+        {
+            range_ok = false;
+            continue;
+        }
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+/* copies through user space buffers, used only when the kernel paths fail */
+static int stream_data_copy(const string &src_path, const string &dest_path)
+{
+    ifstream in(src_path);
+    ofstream out(dest_path, ios::out | ios::trunc);
+    if(!in.is_open() || !out.is_open())
+        return FAILURE;
+
+    out << in.rdbuf();
+    out.close();
+    return (in.bad() || out.fail()) ? FAILURE : SUCCESS;
+}
+
+static int fd_write_full(int fd, const char *buf, size_t len)
+{
+    while(len)
+    {
+        ssize_t n = write(fd, buf, len);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return FAILURE;
+        buf += n;
+        len -= n;
+    }
+    return SUCCESS;
+}
+
+/* XXH64 of everything fd holds from offset 0, read without the page cache's
+ * help where the kernel lets go of the pages
+ */
+static int fd_sum_get(int fd, vector<char> &buf, uint64_t &sum)
+{
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+
+    xxh64_state state;
+    off_t off = 0;
+    while(1)
+    {
+        ssize_t n = pread(fd, buf.data(), buf.size(), off);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n < 0)
+            return FAILURE;
+        if(n == 0)
+            break;
+        state.update(buf.data(), n);
+        off += n;
+    }
+    sum = state.digest();
+    return SUCCESS;
+}
+
+/* the data path of a verified copy: the source is read once and hashed on
+ * its way to the destination, which is then synced and read back
+ */
+static int verified_data_copy(int in_fd, int out_fd, off_t size, op_ctl *ctl, uint64_t &src_sum,
+                              uint64_t &dest_sum)
+{
+    posix_fadvise(in_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    vector<char> buf(VERIFY_BUF_SIZE);
+    xxh64_state state;
+    off_t copied = 0;
+    while(copied < size)
+    {
+        if(ctl && !ctl->proceed())
+        {
+            errno = ECANCELED;
+            return FAILURE;
+        }
+
+        ssize_t n = read(in_fd, buf.data(), min((off_t) buf.size(), size - copied));
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n < 0)
+            return FAILURE;
+        if(n == 0)              // source shrunk under us
+            break;
+
+        state.update(buf.data(), n);
+        if(FAILURE == fd_write_full(out_fd, buf.data(), n))
+            return FAILURE;
+        copied += n;
+        if(ctl)
+            ctl->bytes_done += n;
+    }
+    src_sum = state.digest();
+
+    if(FAILURE == fdatasync(out_fd))
+        return FAILURE;
+    return fd_sum_get(out_fd, buf, dest_sum);
+}
+
+static void verify_record(copy_verify &verify, int ret, const string &dest_path, uint64_t sum,
+                          const string &err_msg)
+{
+    lock_guard<mutex> lk(verify.lock);
+    if(SUCCESS == ret)
+    {
+        verify.sums.pb(make_pair(sum, dest_path));
+        return;
+    }
+    if(++verify.n_failed <= VERIFY_KEPT)
+        verify.failures.pb(err_msg);
+}
+
+int file_copy(const string &src_path, const string &dest_path, string &err_msg, op_ctl *ctl, copy_verify *verify)
+{
+    stat_scope sc(STAT_FILE_COPY);
+    int in_fd = open(src_path.c_str(), O_RDONLY);
+    if(FAILURE == in_fd)
+    {
+        err_msg = "open failed for " + src_path + "!! errno: " + to_string(errno);
+        return FAILURE;
+    }
+
+    struct stat src_stat;
+    if(FAILURE == fstat(in_fd, &src_stat))
+    {
+        err_msg = "stat failed for " + src_path + "!! errno: " + to_string(errno);
+        close(in_fd);
+        return FAILURE;
+    }
+
+    /* a verified copy reads its destination back */
+    int out_fd = open(dest_path.c_str(), (verify ? O_RDWR : O_WRONLY) | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+    if(FAILURE == out_fd)
+    {
+        err_msg = "open failed for " + dest_path + "!! errno: " + to_string(errno);
+        close(in_fd);
+        if(verify)
+            verify_record(*verify, FAILURE, dest_path, 0, err_msg);
+        return FAILURE;
+    }
+
+    uint64_t src_sum = 0, dest_sum = 0;
+    int ret = verify ? verified_data_copy(in_fd, out_fd, src_stat.st_size, ctl, src_sum, dest_sum)
+                     : fd_data_copy(in_fd, out_fd, src_stat.st_size, ctl);
+    if(FAILURE == ret && ECANCELED == errno)
+    {
+        err_msg = "Cancelled";
+        close(out_fd);
+        close(in_fd);
+        unlink(dest_path.c_str());      // no half copies left behind
+        return FAILURE;
+    }
+    if(FAILURE == ret && !verify && SUCCESS == ftruncate(out_fd, 0) && SUCCESS == lseek(in_fd, 0, SEEK_SET))
+        ret = stream_data_copy(src_path, dest_path);
+    if(FAILURE == ret)
+    {
+        err_msg = "copy failed for " + src_path + "!! errno: " + to_string(errno);
+    }
+    else
+    {
+        struct stat dest_stat;
+        if(FAILURE == fstat(out_fd, &dest_stat) || dest_stat.st_size != src_stat.st_size)
+        {
+            err_msg = "copy of " + src_path + " is incomplete!!";
+            ret = FAILURE;
+        }
+        else if(src_sum != dest_sum)
+        {
+            err_msg = "checksum mismatch for " + dest_path + "!!";
+            ret = FAILURE;
+        }
+    }
+
+    /* only root may hand a file over to another owner, others keep it */
+    if(SUCCESS == ret && FAILURE == fchmod(out_fd, src_stat.st_mode & 07777))
+    {
+        err_msg = "chmod failed for " + dest_path + "!! errno: " + to_string(errno);
+        ret = FAILURE;
+    }
+    if(SUCCESS == ret && FAILURE == fchown(out_fd, src_stat.st_uid, src_stat.st_gid) &&
+       (errno != EPERM || geteuid() == 0))
+    {
+        err_msg = "chown failed for " + dest_path + "!! errno: " + to_string(errno);
+        ret = FAILURE;
+    }
+    if(SUCCESS == ret)
+    {
+        sc.bytes_add(src_stat.st_size);
+        if(ctl)
+            ++ctl->files_done;
+    }
+    if(verify)
+        verify_record(*verify, ret, dest_path, dest_sum, err_msg);
+
+    close(out_fd);
+    close(in_fd);
+    return ret;
+}
+
+static int symlink_copy(const string &src_path, const string &dest_path, string &err_msg)
+{
+    char target[PATH_MAX];
+    ssize_t len = readlink(src_path.c_str(), target, sizeof(target) - 1);
+    if(FAILURE == len)
+    {
+        err_msg = "readlink failed for " + src_path + "!! errno: " + to_string(errno);
+        return FAILURE;
+    }
+    target[len] = '\0';
+
+    if(FAILURE == symlink(target, dest_path.c_str()))
+    {
+        err_msg = "symlink failed for " + dest_path + "!! errno: " + to_string(errno);
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+/* creates dest_path and walks src_path, handing every file over to the pool.
+ * A directory is always created before the copies of its files are queued.
+ * Its entries are read and the directory closed before descending, so the
+ * open descriptors do not grow with the depth of the tree.
+ */
+static void dir_walk_copy(copy_ctx &ctx, const string &src_path, const string &dest_path, mode_t mode)
+{
+    if(FAILURE == mkdir(dest_path.c_str(), S_IRWXU))
+    {
+        if(EEXIST == errno)
+            copy_error_set(ctx, "Destination directory already exists!!");
+        else
+            copy_error_set(ctx, "mkdir failed for " + dest_path + "!! errno: " + to_string(errno));
+        return;
+    }
+    ctx.dirs.pb({src_path, dest_path, mode});
+
+    DIR *dir = opendir(src_path.c_str());
+    if(!dir)
+    {
+        copy_error_set(ctx, "opendir failed for " + src_path + "!! errno: " + to_string(errno));
+        return;
+    }
+
+    vector<pair<string, unsigned char>> entries;
+    struct dirent *dir_entry;
+    while((dir_entry = readdir(dir)))
+    {
+        if(strcmp(dir_entry->d_name, ".") && strcmp(dir_entry->d_name, ".."))
+            entries.pb(make_pair(string(dir_entry->d_name), dir_entry->d_type));
+    }
+    closedir(dir);
+
+    work_pool &pool = pool_get();
+    for(auto &entry : entries)
+    {
+        if(ctx.ctl && !ctx.ctl->proceed())
+        {
+            copy_error_set(ctx, "Cancelled");
+            break;
+        }
+
+        string src_child = src_path + "/" + entry.first;
+        string dest_child = dest_path + "/" + entry.first;
+
+        unsigned char type = entry.second;
+        struct stat child_stat;
+        if(type == DT_UNKNOWN || type == DT_DIR)
+        {
+            if(FAILURE == lstat(src_child.c_str(), &child_stat))
+            {
+                copy_error_set(ctx, "lstat failed for " + src_child + "!! errno: " + to_string(errno));
+                continue;
+            }
+            type = IFTODT(child_stat.st_mode);
+        }
+
+        switch(type)
+        {
+            case DT_DIR:
+                dir_walk_copy(ctx, src_child, dest_child, child_stat.st_mode);
+                break;
+
+            case DT_REG:
+                pool.submit(ctx.grp, [&ctx, src_child, dest_child]
+                {
+                    string msg;
+                    if(ctx.ctl && !ctx.ctl->proceed())
+                        copy_error_set(ctx, "Cancelled");
+                    else if(FAILURE == file_copy(src_child, dest_child, msg, ctx.ctl, ctx.verify))
+                        copy_error_set(ctx, msg);
+                    else if(ctx.remove_src && FAILURE == unlink(src_child.c_str()))
+                        copy_error_set(ctx, "unlink failed for " + src_child + "!! errno: " + to_string(errno));
+                });
+                break;
+
+            case DT_LNK:
+            {
+                string msg;
+                if(FAILURE == symlink_copy(src_child, dest_child, msg))
+                    copy_error_set(ctx, msg);
+                else if(ctx.remove_src && FAILURE == unlink(src_child.c_str()))
+                    copy_error_set(ctx, "unlink failed for " + src_child + "!! errno: " + to_string(errno));
+                else if(ctx.ctl)
+                    ++ctx.ctl->files_done;
+                break;
+            }
+
+            default:
+                copy_error_set(ctx, "Skipped special file " + src_child);
+                break;
+        }
+    }
+}
+
+/* copies the directory src_dir_path into dest_dir_path: the directory
+ * skeleton is created by the calling thread while the file copies are
+ * spread over the work pool. With remove_src every source file is unlinked
+ * right after its copy is checked, and the emptied source directories are
+ * removed at the end.
+ */
+static int tree_transfer(const string &src_dir_path, const string &dest_dir_path, bool remove_src, string &err_msg,
+                         op_ctl *ctl, copy_verify *verify)
+{
+    string src_path = src_dir_path, dest_path = dest_dir_path;
+    while(src_path.length() > 1 && src_path[src_path.length() - 1] == '/')
+        src_path.erase(src_path.length() - 1);
+    while(dest_path.length() > 1 && dest_path[dest_path.length() - 1] == '/')
+        dest_path.erase(dest_path.length() - 1);
+
+    if((dest_path + "/").compare(0, src_path.length() + 1, src_path + "/") == 0)
+    {
+        err_msg = "Cannot copy a directory into itself!!";
+        return FAILURE;
+    }
+
+    struct stat src_stat;
+    if(FAILURE == stat(src_path.c_str(), &src_stat))
+    {
+        err_msg = "stat failed for " + src_path + "!! errno: " + to_string(errno);
+        return FAILURE;
+    }
+
+    copy_ctx ctx;
+    ctx.remove_src = remove_src;
+    ctx.ctl = ctl;
+    ctx.verify = verify;
+    size_t fwd_slash_pos = src_path.find_last_of("/");
+    dir_walk_copy(ctx, src_path, dest_path + "/" + src_path.substr(fwd_slash_pos + 1), src_stat.st_mode);
+    pool_get().wait(ctx.grp);
+
+    /* directories were created writable for the copy, restore their modes
+     * children first so that read-only parents do not get in the way
+     */
+    for(auto itr = ctx.dirs.rbegin(); itr != ctx.dirs.rend(); ++itr)
+    {
+        if(FAILURE == chmod(itr->dest_path.c_str(), itr->mode & 07777))
+            copy_error_set(ctx, "chmod failed for " + itr->dest_path + "!! errno: " + to_string(errno));
+        if(remove_src && FAILURE == rmdir(itr->src_path.c_str()))
+            copy_error_set(ctx, "rmdir failed for " + itr->src_path + "!! errno: " + to_string(errno));
+    }
+
+    if(!ctx.err_msg.empty())
+    {
+        err_msg = ctx.err_msg;
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+int tree_copy(const string &src_dir_path, const string &dest_dir_path, string &err_msg, op_ctl *ctl,
+              copy_verify *verify)
+{
+    return tree_transfer(src_dir_path, dest_dir_path, false, err_msg, ctl, verify);
+}
+
+/* moves src_path (file or directory) into dest_dir_path. Within a filesystem
+ * this is a single rename; across filesystems the data is copied and every
+ * source file is unlinked as soon as its copy is done.
+ */
+int path_move(const string &src_path, const string &dest_dir_path, string &err_msg, op_ctl *ctl)
+{
+    string dest_path = dest_dir_path;
+    if(dest_path[dest_path.length() - 1] != '/')
+        dest_path += "/";
+    size_t fwd_slash_pos = src_path.find_last_of("/", src_path.length() - 2);
+    string name = src_path.substr(fwd_slash_pos + 1);
+    if(name[name.length() - 1] == '/')
+        name.erase(name.length() - 1);
+    dest_path += name;
+
+    int ret = renameat2(AT_FDCWD, src_path.c_str(), AT_FDCWD, dest_path.c_str(), RENAME_NOREPLACE);
+    if(FAILURE == ret && EINVAL == errno && FAILURE == access(dest_path.c_str(), F_OK))
+        ret = rename(src_path.c_str(), dest_path.c_str());     // filesystem without RENAME_NOREPLACE
+    if(SUCCESS == ret)
+    {
+        if(ctl)
+        {
+            ++ctl->files_total;
+            ++ctl->files_done;
+        }
+        return SUCCESS;
+    }
+
+    switch(errno)
+    {
+        case EXDEV:
+            break;
+        case EEXIST:
+        case ENOTEMPTY:
+            err_msg = name + " already exists at the destination!!";
+            return FAILURE;
+        case ENOENT:
+            err_msg = name + " doesn't exist!!";
+            return FAILURE;
+        default:
+            err_msg = "rename failed for " + src_path + "!! errno: " + to_string(errno);
+            return FAILURE;
+    }
+
+    struct stat src_stat;
+    if(FAILURE == lstat(src_path.c_str(), &src_stat))
+    {
+        err_msg = "stat failed for " + src_path + "!! errno: " + to_string(errno);
+        return FAILURE;
+    }
+    /* only now is it known that data has to move */
+    if(ctl)
+        tree_totals_add(src_path, *ctl);
+    if(S_ISDIR(src_stat.st_mode))
+        return tree_transfer(src_path, dest_dir_path, true, err_msg, ctl, NULL);
+
+    if(S_ISLNK(src_stat.st_mode))
+    {
+        ret = symlink_copy(src_path, dest_path, err_msg);
+        if(SUCCESS == ret && ctl)
+            ++ctl->files_done;
+    }
+    else
+    {
+        ret = file_copy(src_path, dest_path, err_msg, ctl);
+    }
+    if(SUCCESS == ret && FAILURE == unlink(src_path.c_str()))
+    {
+        err_msg = "unlink failed for " + src_path + "!! errno: " + to_string(errno);
+        ret = FAILURE;
+    }
+    return ret;
+}
+
+/* a directory being deleted. It is unlinked from its parent once the last
+ * of its sub-directories, removed in parallel, is gone. Up to
+ * DELETE_FDS_KEPT directories stay open meanwhile, so that the work below
+ * them is relative to their fd; the others are closed after their scan and
+ * reached by path, which keeps deep trees within the fd limit.
+ */
+struct delete_node
+{
+    int            fd;          // FAILURE once closed
+    string         path;
+    string         name;        // relative to the parent
+    delete_node   *parent;
+    atomic<int>    pending;     // sub-directories still to remove, +1 while scanning
+
+    delete_node(int dfd, const string &p, const string &n, delete_node *par):
+        fd(dfd), path(p), name(n), parent(par), pending(1) {}
+};
+
+struct delete_ctx
+{
+    work_group   grp;
+    mutex        err_lock;
+    string       err_msg;
+    atomic<int>  n_fds_kept;
+    op_ctl      *ctl;
+
+    delete_ctx(): n_fds_kept(0), ctl(NULL) {}
+};
+
+static void delete_error_set(delete_ctx &ctx, const string &msg)
+{
+    lock_guard<mutex> lk(ctx.err_lock);
+    if(ctx.err_msg.empty())
+        ctx.err_msg = msg;
+}
+
+static void delete_node_release(delete_ctx &ctx, delete_node *node)
+{
+    while(node->parent && 0 == --node->pending)
+    {
+        delete_node *parent = node->parent;
+        if(FAILURE != node->fd)
+        {
+            close(node->fd);
+            --ctx.n_fds_kept;
+        }
+        int ret = (FAILURE != parent->fd) ? unlinkat(parent->fd, node->name.c_str(), AT_REMOVEDIR)
+                                          : rmdir(node->path.c_str());
+        if(FAILURE == ret)
+            delete_error_set(ctx, "rmdir failed for " + node->name + "!! errno: " + to_string(errno));
+        delete node;
+        node = parent;
+    }
+}
+
+/* empties the directory name of parent: files are unlinked relative to its
+ * fd, sub-directories become new pool tasks
+ */
+static void dir_delete_task(delete_ctx &ctx, delete_node *parent, const string &name)
+{
+    string path = parent->path + "/" + name;
+    int fd;
+    if(FAILURE != parent->fd)
+        fd = openat(parent->fd, name.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    else
+        fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if(FAILURE == fd)
+    {
+        delete_error_set(ctx, "open failed for " + name + "!! errno: " + to_string(errno));
+        delete_node_release(ctx, parent);
+        return;
+    }
+
+    /* read the whole directory before removing anything from it */
+    vector<pair<string, unsigned char>> entries;
+    {
+        dirent_stream ds(fd);
+        const char *entry_name;
+        unsigned char type;
+        ino_t ino;
+        while(ds.next(entry_name, type, ino))
+            entries.pb(make_pair(string(entry_name), type));
+        if(ds.error())
+            delete_error_set(ctx, "getdents failed for " + name + "!! errno: " + to_string(ds.error()));
+    }
+
+    vector<string> sub_dirs;
+    for(auto &entry : entries)
+    {
+        if(ctx.ctl && !ctx.ctl->proceed())
+        {
+            delete_error_set(ctx, "Cancelled");
+            sub_dirs.clear();
+            break;
+        }
+
+        unsigned char type = entry.second;
+        if(type == DT_UNKNOWN)
+        {
+            struct stat entry_stat;
+            if(SUCCESS == fstatat(fd, entry.first.c_str(), &entry_stat, AT_SYMLINK_NOFOLLOW))
+                type = IFTODT(entry_stat.st_mode);
+        }
+
+        if(type == DT_DIR)
+            sub_dirs.pb(entry.first);
+        else if(FAILURE == unlinkat(fd, entry.first.c_str(), 0))
+            delete_error_set(ctx, "unlink failed for " + entry.first + "!! errno: " + to_string(errno));
+        else if(ctx.ctl)
+            ++ctx.ctl->files_done;
+    }
+
+    /* closed before any child can use it, if too many are open already */
+    if(sub_dirs.empty() || ctx.n_fds_kept++ >= DELETE_FDS_KEPT)
+    {
+        if(!sub_dirs.empty())
+            --ctx.n_fds_kept;
+        close(fd);
+        fd = FAILURE;
+    }
+    delete_node *node = new delete_node(fd, path, name, parent);
+
+    work_pool &pool = pool_get();
+    for(auto &child : sub_dirs)
+    {
+        ++node->pending;
+        pool.submit(ctx.grp, [&ctx, node, child] { dir_delete_task(ctx, node, child); });
+    }
+    delete_node_release(ctx, node);
+}
+
+/* removes the directory dir_path with everything below it; independent
+ * sub-trees are removed in parallel on the work pool
+ */
+int tree_delete(const string &dir_path, string &err_msg, op_ctl *ctl)
+{
+    string path = dir_path;
+    while(path.length() > 1 && path[path.length() - 1] == '/')
+        path.erase(path.length() - 1);
+
+    size_t fwd_slash_pos = path.find_last_of("/");
+    string parent_path = (fwd_slash_pos == 0) ? "/" : path.substr(0, fwd_slash_pos);
+    int parent_fd = open(parent_path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(FAILURE == parent_fd)
+    {
+        err_msg = "open failed for " + parent_path + "!! errno: " + to_string(errno);
+        return FAILURE;
+    }
+
+    /* the parent is never released, it only anchors the tree */
+    delete_node root(parent_fd, parent_path, parent_path, NULL);
+    delete_ctx ctx;
+    ctx.ctl = ctl;
+    root.pending = 2;
+    string name = path.substr(fwd_slash_pos + 1);
+    pool_get().submit(ctx.grp, [&ctx, &root, name] { dir_delete_task(ctx, &root, name); });
+    pool_get().wait(ctx.grp);
+    close(parent_fd);
+
+    if(!ctx.err_msg.empty())
+    {
+        err_msg = ctx.err_msg;
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+/* the directory is read and closed before its sub-directories are, so the
+ * count takes one fd whatever the depth of the tree
+ */
+static void dir_totals_add(const string &dir_path, op_ctl &ctl)
+{
+    int dir_fd = open(dir_path.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if(FAILURE == dir_fd)
+        return;
+
+    vector<string> sub_dirs;
+    {
+        dirent_stream ds(dir_fd);
+        const char *name;
+        unsigned char type;
+        ino_t ino;
+        while(ds.next(name, type, ino))
+        {
+            struct stat entry_stat;
+            if(type != DT_DIR && type != DT_REG && type != DT_UNKNOWN)
+            {
+                ++ctl.files_total;
+                continue;
+            }
+            if(FAILURE == fstatat(dir_fd, name, &entry_stat, AT_SYMLINK_NOFOLLOW))
+                continue;
+
+            if(S_ISDIR(entry_stat.st_mode))
+            {
+                sub_dirs.pb(name);
+            }
+            else
+            {
+                ++ctl.files_total;
+                if(S_ISREG(entry_stat.st_mode))
+                    ctl.bytes_total += entry_stat.st_size;
+            }
+        }
+    }
+    close(dir_fd);
+
+    for(auto &sub_dir : sub_dirs)
+        dir_totals_add(dir_path + "/" + sub_dir, ctl);
+}
+
+void tree_totals_add(const string &path, op_ctl &ctl)
+{
+    struct stat path_stat;
+    if(FAILURE == lstat(path.c_str(), &path_stat))
+        return;
+    if(!S_ISDIR(path_stat.st_mode))
+    {
+        ++ctl.files_total;
+        if(S_ISREG(path_stat.st_mode))
+            ctl.bytes_total += path_stat.st_size;
+        return;
+    }
+    dir_totals_add(path, ctl);
+}
+
+int manifest_write(const string &manifest_path, copy_verify &verify, string &err_msg)
+{
+    lock_guard<mutex> lk(verify.lock);
+    sort(verify.sums.begin(), verify.sums.end(), [](const pair<uint64_t, string> &a, const pair<uint64_t, string> &b)
+    {
+        return a.second < b.second;
+    });
+
+    ofstream out(manifest_path, ios::out | ios::trunc);
+    if(!out.is_open())
+    {
+        err_msg = "open failed for " + manifest_path + "!! errno: " + to_string(errno);
+        return FAILURE;
+    }
+    char sum_str[17];
+    for(auto &sum : verify.sums)
+    {
+        snprintf(sum_str, sizeof(sum_str), "%016" PRIx64, sum.first);
+        out << sum_str << "  " << sum.second << "\n";
+    }
+    out.close();
+    if(out.fail())
+    {
+        err_msg = "write failed for " + manifest_path + "!!";
+        return FAILURE;
+    }
+    return SUCCESS;
+}
@@ -0,0 +1,77 @@
+#ifndef _FILE_OPS_H_
+#define _FILE_OPS_H_
+
+#include <string>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+
+#define OP_CHUNK_SIZE   (8 << 20)       // bytes copied between two looks at the op_ctl
+#define VERIFY_BUF_SIZE (1 << 20)       // bytes per read and write of a verified copy
+#define VERIFY_KEPT     100             // failures of a verified copy described one by one
+#define DELETE_FDS_KEPT 64              // directories a delete keeps open to work relative to
+
+/* progress and control of a long operation, shared between the threads
+ * running it and whoever watches it. Totals are filled in by a counting
+ * pass before the work starts and stay 0 where nothing is known up front.
+ */
+struct op_ctl
+{
+    std::atomic<uint64_t>    bytes_total;
+    std::atomic<uint64_t>    bytes_done;
+    std::atomic<uint64_t>    files_total;
+    std::atomic<uint64_t>    files_done;
+    std::atomic<bool>        cancelled;
+    std::atomic<bool>        paused;
+    std::mutex               pause_lock;
+    std::condition_variable  pause_cv;
+
+    op_ctl(): bytes_total(0), bytes_done(0), files_total(0), files_done(0), cancelled(false), paused(false) {}
+
+    /* blocks while paused; false once the operation is cancelled */
+    bool proceed();
+    void pause(bool on);
+    void cancel();
+};
+
+/* what a verified copy found, filled in by every file_copy() given it.
+ * Such a copy goes through a buffer, hashing the source with XXH64 as it
+ * is read; the destination is then synced, dropped from the page cache and
+ * read back to be hashed again.
+ */
+struct copy_verify
+{
+    std::mutex                                     lock;
+    std::vector<std::pair<uint64_t, std::string>>  sums;       // XXH64 and path of every good copy
+    std::vector<std::string>                       failures;   // the first VERIFY_KEPT failed files
+    uint64_t                                       n_failed;
+
+    copy_verify(): n_failed(0) {}
+};
+
+/* terminal independent file operations, safe to run from worker threads.
+ * They return SUCCESS/FAILURE and describe the failure in err_msg.
+ * With a ctl they report their progress there and stop early, failing
+ * with "Cancelled", once it is cancelled.
+ */
+int file_copy(const std::string &src_path, const std::string &dest_path, std::string &err_msg,
+              op_ctl *ctl = NULL, copy_verify *verify = NULL);
+int tree_copy(const std::string &src_dir_path, const std::string &dest_dir_path, std::string &err_msg,
+              op_ctl *ctl = NULL, copy_verify *verify = NULL);
+int path_move(const std::string &src_path, const std::string &dest_dir_path, std::string &err_msg,
+              op_ctl *ctl = NULL);
+int tree_delete(const std::string &dir_path, std::string &err_msg, op_ctl *ctl = NULL);
+
+/* adds the size and the number of files below path (or of path itself) to
+ * the totals of ctl, without following symbolic links
+ */
+void tree_totals_add(const std::string &path, op_ctl &ctl);
+
+/* writes the checksums of a verified copy as "<xxh64>  <path>" lines sorted
+ * by path, the format xxhsum -c reads
+ */
+int manifest_write(const std::string &manifest_path, copy_verify &verify, std::string &err_msg);
+
+#endif
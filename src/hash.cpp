@@ -0,0 +1,138 @@
+#include "hash.h"
+
+#include <cstring>
+
+static const uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t PRIME3 = 0x165667B19E3779F9ULL;
+static const uint64_t PRIME4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t PRIME5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t rotl(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;       // little-endian hosts only, as everything else here
+}
+
+static inline uint32_t read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t round(uint64_t acc, uint64_t input)
+{
+    acc += input * PRIME2;
+    acc = rotl(acc, 31);
+    return acc * PRIME1;
+}
+
+static inline uint64_t merge_round(uint64_t acc, uint64_t lane)
+{
+    acc ^= round(0, lane);
+    return acc * PRIME1 + PRIME4;
+}
+
+xxh64_state::xxh64_state(uint64_t s): seed(s), total_len(0), buf_len(0)
+{
+    lanes[0] = seed + PRIME1 + PRIME2;
+    lanes[1] = seed + PRIME2;
+    lanes[2] = seed;
+    lanes[3] = seed - PRIME1;
+}
+
+void xxh64_state::update(const void *data, size_t len)
+{
+    const uint8_t *p = (const uint8_t*) data;
+    total_len += len;
+
+    if(buf_len + len < 32)
+    {
+        memcpy(buf + buf_len, p, len);
+        buf_len += len;
+        return;
+    }
+    if(buf_len)
+    {
+        size_t fill = 32 - buf_len;
+        memcpy(buf + buf_len, p, fill);
+        for(int i = 0; i < 4; ++i)
+            lanes[i] = round(lanes[i], read64(buf + 8 * i));
+        p += fill;
+        len -= fill;
+        buf_len = 0;
+    }
+
+    /* the hot loop: the four lanes do not depend on each other */
+    uint64_t v1 = lanes[0], v2 = lanes[1], v3 = lanes[2], v4 = lanes[3];
+    const uint8_t *end = p + (len & ~(size_t) 31);
+    for(; p < end; p += 32)
+    {
+        v1 = round(v1, read64(p));
+        v2 = round(v2, read64(p + 8));
+        v3 = round(v3, read64(p + 16));
+        v4 = round(v4, read64(p + 24));
+    }
+    lanes[0] = v1;
+    lanes[1] = v2;
+    lanes[2] = v3;
+    lanes[3] = v4;
+
+    buf_len = len & 31;
+    memcpy(buf, p, buf_len);
+}
+
+uint64_t xxh64_state::digest() const
+{
+    uint64_t h;
+    if(total_len >= 32)
+    {
+        h = rotl(lanes[0], 1) + rotl(lanes[1], 7) + rotl(lanes[2], 12) + rotl(lanes[3], 18);
+        for(int i = 0; i < 4; ++i)
+            h = merge_round(h, lanes[i]);
+    }
+    else
+    {
+        h = seed + PRIME5;
+    }
+    h += total_len;
+
+    const uint8_t *p = buf, *end = buf + buf_len;
+    for(; p + 8 <= end; p += 8)
+    {
+        h ^= round(0, read64(p));
+        h = rotl(h, 27) * PRIME1 + PRIME4;
+    }
+    if(p + 4 <= end)
+    {
+        h ^= (uint64_t) read32(p) * PRIME1;
+        h = rotl(h, 23) * PRIME2 + PRIME3;
+        p += 4;
+    }
+    for(; p < end; ++p)
+    {
+        h ^= (*p) * PRIME5;
+        h = rotl(h, 11) * PRIME1;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME2;
+    h ^= h >> 29;
+    h *= PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+uint64_t xxh64(const void *data, size_t len, uint64_t seed)
+{
+    xxh64_state st(seed);
+    st.update(data, len);
+    return st.digest();
+}
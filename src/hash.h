@@ -0,0 +1,29 @@
+#ifndef _HASH_H_
+#define _HASH_H_
+
+#include <cstddef>
+#include <cstdint>
+
+/* XXH64: four independent 64-bit lanes over 32-byte stripes, which keeps
+ * the multipliers of all lanes in flight at once. Feed data with update()
+ * in pieces of any size; digest() does not change the state.
+ */
+class xxh64_state
+{
+public:
+    explicit xxh64_state(uint64_t seed = 0);
+
+    void     update(const void *data, size_t len);
+    uint64_t digest() const;
+
+private:
+    uint64_t  lanes[4];
+    uint64_t  seed;
+    uint64_t  total_len;
+    uint8_t   buf[32];
+    size_t    buf_len;
+};
+
+uint64_t xxh64(const void *data, size_t len, uint64_t seed = 0);
+
+#endif
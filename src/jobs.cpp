@@ -0,0 +1,357 @@
+#include "jobs.h"
+#include "thread_pool.h"
+#include "common.h"
+#include "includes.h"
+
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <sys/timerfd.h>
+
+using namespace std;
+
+struct job
+{
+    int                               id;
+    string                            desc;
+    job_fn                            fn;
+    int                               state;        // JOB_QUEUED, JOB_RUNNING or a finished state
+    string                            err_msg;
+    op_ctl                            ctl;
+    chrono::steady_clock::time_point  start;
+    chrono::steady_clock::time_point  end;
+};
+
+static mutex                     jobs_lock;
+static condition_variable        jobs_cv;
+static deque<unique_ptr<job>>    jobs;              // in submission order
+static int                       next_job_id = 1;
+static unsigned int              n_finished;
+static bool                      runner_stop;
+static thread                    runner;
+static unique_ptr<work_pool>     jobs_pool;
+static int                       tick_fd = FAILURE;
+
+/* fires at once, then every JOBS_TICK_MS while active */
+static void tick_arm(bool active)
+{
+    struct itimerspec its = {};
+    its.it_value.tv_nsec = 1;
+    if(active)
+        its.it_interval.tv_nsec = JOBS_TICK_MS * 1000000L;
+    timerfd_settime(jobs_fd(), 0, &its, NULL);
+}
+
+static int job_state_get(const job &j)
+{
+    if((j.state == JOB_QUEUED || j.state == JOB_RUNNING) && j.ctl.paused)
+        return JOB_PAUSED;
+    return j.state;
+}
+
+/* the first queued job that is not held; called with jobs_lock held */
+static job* job_next_get()
+{
+    for(auto &j : jobs)
+    {
+        if(j->state == JOB_QUEUED && !j->ctl.paused)
+            return j.get();
+    }
+    return NULL;
+}
+
+static bool jobs_pending()
+{
+    for(auto &j : jobs)
+    {
+        if(j->state == JOB_QUEUED || j->state == JOB_RUNNING)
+            return true;
+    }
+    return false;
+}
+
+static void runner_run()
+{
+    pool_bind(jobs_pool.get());
+
+    unique_lock<mutex> lk(jobs_lock);
+    while(1)
+    {
+        job *jp = runner_stop ? NULL : job_next_get();
+        if(!jp)
+        {
+            if(runner_stop)
+                break;
+            jobs_cv.wait(lk);
+            continue;
+        }
+
+        jp->state = JOB_RUNNING;
+        jp->start = chrono::steady_clock::now();
+        tick_arm(true);
+        lk.unlock();
+
+        string err_msg;
+        int ret = jp->fn(jp->ctl, err_msg);
+
+        lk.lock();
+        jp->fn = nullptr;
+        jp->end = chrono::steady_clock::now();
+        if(SUCCESS == ret)
+            jp->state = JOB_DONE;
+        else
+            jp->state = jp->ctl.cancelled ? JOB_CANCELLED : JOB_FAILED;
+        jp->err_msg = err_msg;
+        ++n_finished;
+
+        /* forget the oldest finished jobs beyond JOBS_KEPT */
+        size_t n_kept = 0;
+        for(auto itr = jobs.rbegin(); itr != jobs.rend(); ++itr)
+        {
+            if((*itr)->state >= JOB_DONE)
+                ++n_kept;
+        }
+        for(auto itr = jobs.begin(); itr != jobs.end() && n_kept > JOBS_KEPT; )
+        {
+            if((*itr)->state >= JOB_DONE)
+            {
+                itr = jobs.erase(itr);
+                --n_kept;
+            }
+            else
+            {
+                ++itr;
+            }
+        }
+        tick_arm(jobs_pending());
+    }
+}
+
+int job_submit(const string &desc, job_fn fn)
+{
+    lock_guard<mutex> lk(jobs_lock);
+    if(!runner.joinable())
+    {
+        runner_stop = false;
+        jobs_pool.reset(new work_pool);
+        runner = thread(runner_run);
+    }
+
+    unique_ptr<job> j(new job);
+    j->id = next_job_id++;
+    j->desc = desc;
+    j->fn = move(fn);
+    j->state = JOB_QUEUED;
+    int id = j->id;
+    jobs.pb(move(j));
+
+    tick_arm(true);
+    jobs_cv.notify_all();
+    return id;
+}
+
+/* called with jobs_lock held */
+static job_info job_info_get(const job &j, chrono::steady_clock::time_point now)
+{
+    job_info info;
+    info.id = j.id;
+    info.desc = j.desc;
+    info.state = job_state_get(j);
+    info.err_msg = j.err_msg;
+    info.bytes_total = j.ctl.bytes_total;
+    info.bytes_done = j.ctl.bytes_done;
+    info.files_total = j.ctl.files_total;
+    info.files_done = j.ctl.files_done;
+    info.secs = 0;
+    if(j.state == JOB_RUNNING)
+        info.secs = chrono::duration<double>(now - j.start).count();
+    else if(j.state >= JOB_DONE && j.start.time_since_epoch().count())
+        info.secs = chrono::duration<double>(j.end - j.start).count();
+    return info;
+}
+
+void jobs_get(vector<job_info> &infos)
+{
+    lock_guard<mutex> lk(jobs_lock);
+    auto now = chrono::steady_clock::now();
+    for(auto &j : jobs)
+        infos.pb(job_info_get(*j, now));
+}
+
+/* called with jobs_lock held */
+static job* job_get(int id, string &err_msg)
+{
+    for(auto &j : jobs)
+    {
+        if(j->id == id)
+        {
+            if(j->state >= JOB_DONE)
+            {
+                err_msg = "Job " + to_string(id) + " has already finished!!";
+                return NULL;
+            }
+            return j.get();
+        }
+    }
+    err_msg = "No job " + to_string(id) + "!!";
+    return NULL;
+}
+
+int job_pause(int id, bool on, string &err_msg)
+{
+    lock_guard<mutex> lk(jobs_lock);
+    job *jp = job_get(id, err_msg);
+    if(!jp)
+        return FAILURE;
+
+    jp->ctl.pause(on);
+    if(!on)
+        jobs_cv.notify_all();       // a held job may be next in line now
+    tick_arm(true);
+    return SUCCESS;
+}
+
+int job_cancel(int id, string &err_msg)
+{
+    lock_guard<mutex> lk(jobs_lock);
+    job *jp = job_get(id, err_msg);
+    if(!jp)
+        return FAILURE;
+
+    jp->ctl.cancel();
+    if(jp->state == JOB_QUEUED)
+    {
+        jp->fn = nullptr;
+        jp->state = JOB_CANCELLED;
+        jp->err_msg = "Cancelled";
+        ++n_finished;
+    }
+    tick_arm(jobs_pending());
+    return SUCCESS;
+}
+
+/* cancels whatever is still queued or running and waits for the runner */
+void jobs_shutdown()
+{
+    {
+        lock_guard<mutex> lk(jobs_lock);
+        if(!runner.joinable())
+            return;
+        runner_stop = true;
+        for(auto &j : jobs)
+            j->ctl.cancel();
+    }
+    jobs_cv.notify_all();
+    runner.join();
+}
+
+int jobs_fd()
+{
+    if(FAILURE == tick_fd)
+        tick_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    return tick_fd;
+}
+
+unsigned int jobs_finished_count()
+{
+    lock_guard<mutex> lk(jobs_lock);
+    return n_finished;
+}
+
+static string size_str(uint64_t bytes)
+{
+    const char *units[] = {"B", "KB", "MB", "GB", "TB"};
+    double sz = bytes;
+    int unit = 0;
+    while(sz >= 1024 && unit < 4)
+    {
+        sz /= 1024;
+        ++unit;
+    }
+    char buf[32];
+    snprintf(buf, sizeof(buf), unit ? "%.1f %s" : "%.0f %s", sz, units[unit]);
+    return buf;
+}
+
+static string duration_str(double secs)
+{
+    long s = secs + 0.5;
+    char buf[32];
+    if(s >= 3600)
+        snprintf(buf, sizeof(buf), "%ld:%02ld:%02ld", s / 3600, (s / 60) % 60, s % 60);
+    else
+        snprintf(buf, sizeof(buf), "%ld:%02ld", s / 60, s % 60);
+    return buf;
+}
+
+string job_line_get(const job_info &info)
+{
+    static const char *state_names[] = {"queued", "running", "paused", "done", "failed", "cancelled"};
+
+    string line = "job " + to_string(info.id) + " " + info.desc + ": " + state_names[info.state];
+    string summary = info.err_msg.substr(0, info.err_msg.find('\n'));
+    if(info.state == JOB_FAILED)
+        return line + " - " + summary;
+    if(info.state == JOB_QUEUED || info.state == JOB_CANCELLED)
+        return line;
+
+    if(info.bytes_total)
+    {
+        line += " " + to_string(min<uint64_t>(100, info.bytes_done * 100 / info.bytes_total)) + "% " +
+                size_str(info.bytes_done) + "/" + size_str(info.bytes_total);
+    }
+    else if(info.bytes_done)
+    {
+        line += " " + size_str(info.bytes_done);
+    }
+    line += ", " + to_string(info.files_done);
+    if(info.files_total)
+        line += "/" + to_string(info.files_total);
+    line += " files";
+
+    if(info.secs > 0 && info.bytes_done)
+    {
+        double rate = info.bytes_done / info.secs;
+        line += ", " + size_str(rate) + "/s";
+        if(info.state == JOB_RUNNING && info.bytes_total > info.bytes_done)
+            line += ", ETA " + duration_str((info.bytes_total - info.bytes_done) / rate);
+    }
+    else if(info.state == JOB_RUNNING && info.secs > 0 && info.files_total > info.files_done && info.files_done)
+    {
+        double rate = info.files_done / info.secs;
+        line += ", ETA " + duration_str((info.files_total - info.files_done) / rate);
+    }
+    if(info.state == JOB_DONE)
+        line += " in " + duration_str(info.secs);
+    if(info.state == JOB_DONE && !summary.empty())
+        line += " - " + summary;
+    return line;
+}
+
+string jobs_status_get()
+{
+    lock_guard<mutex> lk(jobs_lock);
+    auto now = chrono::steady_clock::now();
+
+    /* the job in progress, else the most recent one to finish */
+    const job *shown = NULL, *last_finished = NULL;
+    unsigned int n_waiting = 0;
+    for(auto &j : jobs)
+    {
+        if(j->state == JOB_RUNNING)
+            shown = j.get();
+        else if(j->state == JOB_QUEUED)
+            ++n_waiting;
+        else if(j->start.time_since_epoch().count())       // ran, not cancelled while queued
+            last_finished = j.get();
+    }
+    if(!shown && last_finished && now - last_finished->end < chrono::seconds(JOBS_STATUS_SECS))
+        shown = last_finished;
+    if(!shown)
+        return n_waiting ? to_string(n_waiting) + " jobs waiting" : "";
+
+    string line = job_line_get(job_info_get(*shown, now));
+    if(n_waiting)
+        line += " (+" + to_string(n_waiting) + " waiting)";
+    return line;
+}
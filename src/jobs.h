@@ -0,0 +1,59 @@
+#ifndef _JOBS_H_
+#define _JOBS_H_
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstdint>
+
+#include "file_ops.h"
+
+#define JOB_QUEUED          0
+#define JOB_RUNNING         1
+#define JOB_PAUSED          2       // queued or running, held until resumed
+#define JOB_DONE            3
+#define JOB_FAILED          4
+#define JOB_CANCELLED       5
+
+#define JOBS_TICK_MS        500     // status refresh period while jobs are pending
+#define JOBS_KEPT           64      // finished jobs still listed by jobs_get()
+#define JOBS_STATUS_SECS    10      // how long a finished job stays in the status line
+
+typedef std::function<int(op_ctl &ctl, std::string &err_msg)> job_fn;
+
+struct job_info
+{
+    int          id;
+    std::string  desc;
+    int          state;
+    std::string  err_msg;       // why it failed, or a note on how it went; more lines give details
+    uint64_t     bytes_total;
+    uint64_t     bytes_done;
+    uint64_t     files_total;
+    uint64_t     files_done;
+    double       secs;          // running time so far, or in total once finished
+};
+
+/* background queue for the long file operations. Jobs run one after the
+ * other, in submission order, on a runner thread with a work pool of their
+ * own, so the pool the interface waits on never picks up job work.
+ */
+int          job_submit(const std::string &desc, job_fn fn);
+void         jobs_get(std::vector<job_info> &infos);
+int          job_pause(int id, bool on, std::string &err_msg);
+int          job_cancel(int id, std::string &err_msg);
+void         jobs_shutdown();
+
+/* timerfd that becomes readable whenever a job starts or ends, and every
+ * JOBS_TICK_MS while one is pending; the reader drains it
+ */
+int          jobs_fd();
+unsigned int jobs_finished_count();
+
+/* one line on the job running now (or the last one to finish): progress,
+ * throughput and ETA; empty when there is nothing to tell
+ */
+std::string  jobs_status_get();
+std::string  job_line_get(const job_info &info);
+
+#endif
@@ -0,0 +1,88 @@
+#include "listing_cache.h"
+#include "common.h"
+
+#include <sys/stat.h>
+#include <unordered_map>
+#include <utility>
+
+using namespace std;
+
+typedef pair<string, cached_listing> cache_node;
+
+static list<cache_node>                                   lru;        // most recently used first
+static unordered_map<string, list<cache_node>::iterator>  lru_index;
+
+int listing_stamp_get(const string &dir_path, listing_stamp &stamp)
+{
+    struct stat st;
+    if(FAILURE == stat(dir_path.c_str(), &st))
+        return FAILURE;
+
+    stamp.dev = st.st_dev;
+    stamp.ino = st.st_ino;
+    stamp.mtime = st.st_mtim;
+    stamp.ctime = st.st_ctim;
+    return SUCCESS;
+}
+
+static bool timespec_equal(const struct timespec &a, const struct timespec &b)
+{
+    return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+static bool stamp_equal(const listing_stamp &a, const listing_stamp &b)
+{
+    return a.dev == b.dev && a.ino == b.ino && timespec_equal(a.mtime, b.mtime) && timespec_equal(a.ctime, b.ctime);
+}
+
+static void cache_erase(const string &dir_path)
+{
+    auto itr = lru_index.find(dir_path);
+    if(itr == lru_index.end())
+        return;
+    lru.erase(itr->second);
+    lru_index.erase(itr);
+}
+
+/* the contents of listing are moved into the cache */
+void listing_cache_put(const string &dir_path, cached_listing &listing)
+{
+    cache_erase(dir_path);
+
+    lru.emplace_front(dir_path, cached_listing());
+    cached_listing &cl = lru.front().second;
+    cl.contents.swap(listing.contents);
+    cl.stamp = listing.stamp;
+    cl.start_pos = listing.start_pos;
+    cl.selection_pos = listing.selection_pos;
+    lru_index[dir_path] = lru.begin();
+
+    while(lru.size() > LISTING_CACHE_DIRS)
+    {
+        lru_index.erase(lru.back().first);
+        lru.pop_back();
+    }
+}
+
+/* moves the cached listing of dir_path out of the cache if the directory has
+ * not changed since it was built; a stale listing is dropped
+ */
+bool listing_cache_take(const string &dir_path, cached_listing &listing)
+{
+    auto itr = lru_index.find(dir_path);
+    if(itr == lru_index.end())
+        return false;
+
+    cached_listing &cl = itr->second->second;
+    listing_stamp now;
+    bool fresh = (SUCCESS == listing_stamp_get(dir_path, now) && stamp_equal(now, cl.stamp));
+    if(fresh)
+    {
+        listing.contents.swap(cl.contents);
+        listing.stamp = cl.stamp;
+        listing.start_pos = cl.start_pos;
+        listing.selection_pos = cl.selection_pos;
+    }
+    cache_erase(dir_path);
+    return fresh;
+}
@@ -0,0 +1,36 @@
+#ifndef _LISTING_CACHE_H_
+#define _LISTING_CACHE_H_
+
+#include <string>
+#include <list>
+#include <time.h>
+#include <sys/types.h>
+#include "normal_mode.h"
+
+#define LISTING_CACHE_DIRS    16        // listings kept for back/forward navigation
+
+/* identifies the state of a directory when its listing was built */
+struct listing_stamp
+{
+    dev_t            dev;
+    ino_t            ino;
+    struct timespec  mtime;
+    struct timespec  ctime;
+};
+
+struct cached_listing
+{
+    content_store           contents;
+    listing_stamp           stamp;
+    size_t                  start_pos;          // first entry on the screen
+    size_t                  selection_pos;      // highlighted entry
+};
+
+/* bounded LRU cache of built listings keyed by directory path. A listing is
+ * handed back only if one stat() of the directory still matches its stamp.
+ */
+int  listing_stamp_get(const std::string &dir_path, listing_stamp &stamp);
+void listing_cache_put(const std::string &dir_path, cached_listing &listing);
+bool listing_cache_take(const std::string &dir_path, cached_listing &listing);
+
+#endif
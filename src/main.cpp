@@ -0,0 +1,71 @@
+#include "normal_mode.h"
+#include "common.h"
+#include "jobs.h"
+#include "dir_size.h"
+#include "stats.h"
+#include "batch.h"
+#include "includes.h"
+
+#include <signal.h>
+
+using namespace std;
+
+extern string          root_dir;
+extern string          working_dir;
+extern struct termios  prev_attr, new_attr;
+
+int main(int argc, char* argv[])
+{
+    if(argc >= 2 && string(argv[1]) == "--batch")
+    {
+        /* headless, the terminal is left as it is */
+        if(argc > 3)
+        {
+            cerr << "usage: " << argv[0] << " --batch [script|-]\n";
+            return BATCH_EXIT_USAGE;
+        }
+        char *pwd = getenv("PWD");
+        char cwd[PATH_MAX];
+        if(pwd)
+            root_dir = pwd;
+        else if(getcwd(cwd, sizeof(cwd)))
+            root_dir = cwd;
+        else
+            root_dir = "/";
+        if(root_dir != "/")
+            root_dir = root_dir + "/";
+        working_dir = root_dir;
+
+        int ret = batch_run(argc == 3 ? argv[2] : "-");
+
+        string err_msg;
+        if(FAILURE == stats_trace_write(err_msg))
+            cerr << err_msg << "\n";
+        return ret;
+    }
+
+    //cin.get();
+    if(FAILURE == signals_init())
+        cerr << "signals_init failed!! errno: " << errno << "\n";
+
+    tcgetattr(STDIN_FILENO, &prev_attr);
+    new_attr = prev_attr;
+    new_attr.c_lflag &= ~ICANON;
+    new_attr.c_lflag &= ~ECHO;
+    tcsetattr( STDIN_FILENO, TCSANOW, &new_attr);
+
+    root_dir = getenv("PWD");
+    if(root_dir != "/")
+        root_dir = root_dir + "/";
+    working_dir = root_dir;
+
+    enter_normal_mode();
+    jobs_shutdown();        // whatever is still queued or running is cancelled
+    dir_size_cancel();
+
+    tcsetattr( STDIN_FILENO, TCSANOW, &prev_attr);
+
+    string err_msg;
+    if(FAILURE == stats_trace_write(err_msg))
+        cerr << err_msg << "\n";
+}
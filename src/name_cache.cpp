@@ -0,0 +1,91 @@
+#include "name_cache.h"
+#include "common.h"
+#include "stats.h"
+
+#include <grp.h>
+#include <pwd.h>
+#include <time.h>
+#include <unistd.h>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+struct cached_name
+{
+    string  name;
+    time_t  expiry;
+};
+
+static mutex                                  cache_lock;
+static unordered_map<uid_t, cached_name>      user_cache;
+static unordered_map<gid_t, cached_name>      group_cache;
+
+static long lookup_buf_size_get(int name)
+{
+    long size = sysconf(name);
+    return (size > 0) ? size : 16384;
+}
+
+static string user_lookup(uid_t uid)
+{
+    stat_scope sc(STAT_NAME_LOOKUP);
+    struct passwd pwd, *result = NULL;
+    vector<char> buf(lookup_buf_size_get(_SC_GETPW_R_SIZE_MAX));
+
+    while(ERANGE == getpwuid_r(uid, &pwd, buf.data(), buf.size(), &result))
+        buf.resize(buf.size() * 2);
+
+    return result ? string(result->pw_name) : to_string(uid);
+}
+
+static string group_lookup(gid_t gid)
+{
+    stat_scope sc(STAT_NAME_LOOKUP);
+    struct group grp, *result = NULL;
+    vector<char> buf(lookup_buf_size_get(_SC_GETGR_R_SIZE_MAX));
+
+    while(ERANGE == getgrgid_r(gid, &grp, buf.data(), buf.size(), &result))
+        buf.resize(buf.size() * 2);
+
+    return result ? string(result->gr_name) : to_string(gid);
+}
+
+/* the lookup itself runs unlocked: a slow NSS server must not stall the
+ * other threads, at worst two of them resolve the same id
+ */
+template <typename ID>
+static string cached_lookup(unordered_map<ID, cached_name> &cache, ID id, string (*lookup)(ID))
+{
+    time_t now = time(NULL);
+    {
+        lock_guard<mutex> lk(cache_lock);
+        auto itr = cache.find(id);
+        if(itr != cache.end() && itr->second.expiry > now)
+            return itr->second.name;
+    }
+
+    string name = lookup(id);
+
+    lock_guard<mutex> lk(cache_lock);
+    cache[id] = {name, now + NAME_CACHE_TTL};
+    return name;
+}
+
+string user_name_get(uid_t uid)
+{
+    return cached_lookup(user_cache, uid, user_lookup);
+}
+
+string group_name_get(gid_t gid)
+{
+    return cached_lookup(group_cache, gid, group_lookup);
+}
+
+void name_cache_clear()
+{
+    lock_guard<mutex> lk(cache_lock);
+    user_cache.clear();
+    group_cache.clear();
+}
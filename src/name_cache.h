@@ -0,0 +1,17 @@
+#ifndef _NAME_CACHE_H_
+#define _NAME_CACHE_H_
+
+#include <string>
+#include <sys/types.h>
+
+#define NAME_CACHE_TTL    300       // seconds a looked up name stays valid
+
+/* process-wide uid/gid -> name cache in front of the NSS lookups, safe to
+ * use from any thread. Ids without a passwd/group entry are returned as
+ * their number.
+ */
+std::string user_name_get(uid_t uid);
+std::string group_name_get(gid_t gid);
+void        name_cache_clear();
+
+#endif
@@ -0,0 +1,577 @@
+#include "name_index.h"
+#include "dir_scan.h"
+#include "thread_pool.h"
+#include "common.h"
+#include "includes.h"
+
+#include <algorithm>
+#include <atomic>
+#include <fcntl.h>
+#include <functional>
+#include <sys/mman.h>
+#include <unordered_map>
+
+using namespace std;
+
+/* on-disk layout, every section 8-byte aligned:
+ *   index_header | index_dir[n_dirs] | index_entry[n_entries] |
+ *   uint32_t sorted[n_entries] | names (NUL terminated)
+ * Directories are stored in breadth first order, so a parent always comes
+ * before its children; dir 0 is the root. sorted[] holds the entry ids in
+ * byte order of their names.
+ */
+static const char index_magic[8] = {'B', 'F', 'X', 'I', 'D', 'X', '0', '1'};
+
+struct index_header
+{
+    char      magic[8];
+    uint32_t  n_dirs;
+    uint32_t  pad;
+    uint64_t  n_entries;
+    uint64_t  dirs_off;
+    uint64_t  entries_off;
+    uint64_t  sorted_off;
+    uint64_t  names_off;
+    uint64_t  names_size;
+};
+
+struct index_dir
+{
+    uint32_t  parent;
+    uint32_t  entry;        // the entry naming this directory in its parent
+    int64_t   mtime_sec;
+    int64_t   mtime_nsec;
+    uint64_t  ino;
+};
+
+struct index_entry
+{
+    uint32_t  dir;
+    uint32_t  name_off;
+    uint16_t  name_len;
+    uint8_t   type;         // DT_* of the entry
+    uint8_t   pad;
+};
+
+/* a mapped index file */
+struct index_view
+{
+    string               root_path;
+    void                *map;
+    size_t               map_size;
+    const index_header  *hdr;
+    const index_dir     *dirs;
+    const index_entry   *entries;
+    const uint32_t      *sorted;
+    const char          *names;
+
+    index_view(): map(NULL), map_size(0) {}
+};
+
+static index_view cached_view;
+
+static string path_join(const string &dir_path, const char *name)
+{
+    return (dir_path == "/" ? "" : dir_path) + "/" + name;
+}
+
+static uint64_t align8(uint64_t off)
+{
+    return (off + 7) & ~(uint64_t) 7;
+}
+
+static string index_path_get(const string &root_path)
+{
+    const char *cache_home = getenv("XDG_CACHE_HOME");
+    string dir_path;
+    if(cache_home && cache_home[0])
+        dir_path = cache_home;
+    else if(getenv("HOME"))
+        dir_path = string(getenv("HOME")) + "/.cache";
+    else
+        dir_path = "/tmp";
+
+    dir_path += "/bhavi-file-explorer";
+    mkdir(dir_path.substr(0, dir_path.find_last_of("/")).c_str(), S_IRWXU);
+    mkdir(dir_path.c_str(), S_IRWXU);
+
+    stringstream ss;
+    ss << hex << hash<string>()(root_path);
+    return dir_path + "/" + ss.str() + ".idx";
+}
+
+static void view_unmap(index_view &view)
+{
+    if(view.map)
+        munmap(view.map, view.map_size);
+    view = index_view();
+}
+
+/* true if count items of item_size at off lie within a file of file_size */
+static bool section_fits(uint64_t off, uint64_t count, size_t item_size, uint64_t file_size)
+{
+    return off % 8 == 0 && off >= sizeof(index_header) && off <= file_size &&
+           count <= (file_size - off) / item_size;
+}
+
+/* the header of a mapped index is checked against the file before any of
+ * it is used, and so are the references between its sections, so that a
+ * truncated or corrupt file is rejected instead of read out of bounds
+ */
+static bool view_is_sane(const index_view &view)
+{
+    const index_header *hdr = view.hdr;
+    return !memcmp(hdr->magic, index_magic, sizeof(index_magic)) && hdr->n_dirs &&
+           hdr->n_entries <= UINT32_MAX && hdr->names_size && hdr->names_size <= UINT32_MAX &&
+           section_fits(hdr->dirs_off, hdr->n_dirs, sizeof(index_dir), view.map_size) &&
+           section_fits(hdr->entries_off, hdr->n_entries, sizeof(index_entry), view.map_size) &&
+           section_fits(hdr->sorted_off, hdr->n_entries, sizeof(uint32_t), view.map_size) &&
+           section_fits(hdr->names_off, hdr->names_size, 1, view.map_size);
+}
+
+static bool view_refs_are_sane(const index_view &view)
+{
+    const index_header *hdr = view.hdr;
+    if(view.names[hdr->names_size - 1])
+        return false;
+
+    /* a parent comes before its children, entries are stored directory by
+     * directory, and every name is one NUL terminated string of the names
+     */
+    for(uint32_t i = 1; i < hdr->n_dirs; ++i)
+    {
+        if(view.dirs[i].parent >= i || view.dirs[i].entry >= hdr->n_entries ||
+           view.entries[view.dirs[i].entry].dir != view.dirs[i].parent)
+            return false;
+    }
+    for(uint64_t i = 0; i < hdr->n_entries; ++i)
+    {
+        const index_entry &entry = view.entries[i];
+        if(entry.dir >= hdr->n_dirs || (i && entry.dir < view.entries[i - 1].dir) ||
+           (uint64_t) entry.name_off + entry.name_len >= hdr->names_size || view.names[entry.name_off + entry.name_len])
+            return false;
+        if(view.sorted[i] >= hdr->n_entries)
+            return false;
+    }
+    return true;
+}
+
+static int view_map(const string &index_path, const string &root_path, index_view &view)
+{
+    int fd = open(index_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(FAILURE == fd)
+        return FAILURE;
+
+    struct stat index_stat;
+    if(FAILURE == fstat(fd, &index_stat) || (size_t) index_stat.st_size < sizeof(index_header))
+    {
+        close(fd);
+        return FAILURE;
+    }
+
+    void *map = mmap(NULL, index_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+        return FAILURE;
+
+    view.root_path = root_path;
+    view.map = map;
+    view.map_size = index_stat.st_size;
+    view.hdr = (const index_header *) map;
+    if(!view_is_sane(view))
+    {
+        view_unmap(view);
+        return FAILURE;
+    }
+    view.dirs = (const index_dir *) ((const char *) map + view.hdr->dirs_off);
+    view.entries = (const index_entry *) ((const char *) map + view.hdr->entries_off);
+    view.sorted = (const uint32_t *) ((const char *) map + view.hdr->sorted_off);
+    view.names = (const char *) map + view.hdr->names_off;
+    if(!view_refs_are_sane(view))
+    {
+        view_unmap(view);
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+/* path of every directory of the index, root first */
+static void dir_paths_get(const index_view &view, vector<string> &dir_paths)
+{
+    dir_paths.resize(view.hdr->n_dirs);
+    dir_paths[0] = view.root_path;
+    for(uint32_t i = 1; i < view.hdr->n_dirs; ++i)
+    {
+        const index_dir &dir = view.dirs[i];
+        dir_paths[i] = path_join(dir_paths[dir.parent], view.names + view.entries[dir.entry].name_off);
+    }
+}
+
+/* flags the directories of the index that were modified or replaced since
+ * it was written; returns how many there are
+ */
+static size_t dirs_stale_get(const index_view &view, const vector<string> &dir_paths, vector<char> &stale)
+{
+    atomic<size_t> n_stale(0);
+    const size_t chunk = 4096;
+    work_pool &pool = pool_get();
+    work_group grp;
+
+    stale.assign(dir_paths.size(), 0);
+    for(size_t start = 0; start < dir_paths.size(); start += chunk)
+    {
+        size_t end = min(start + chunk, dir_paths.size());
+        pool.submit(grp, [&view, &dir_paths, &stale, &n_stale, start, end]
+        {
+            struct stat dir_stat;
+            for(size_t i = start; i < end; ++i)
+            {
+                const index_dir &dir = view.dirs[i];
+                if(FAILURE == stat(dir_paths[i].c_str(), &dir_stat) || dir_stat.st_ino != dir.ino ||
+                   dir_stat.st_mtim.tv_sec != dir.mtime_sec || dir_stat.st_mtim.tv_nsec != dir.mtime_nsec)
+                {
+                    stale[i] = 1;
+                    ++n_stale;
+                }
+            }
+        });
+    }
+    pool.wait(grp);
+    return n_stale;
+}
+
+static bool write_all(int fd, const void *buf, size_t len)
+{
+    const char *p = (const char *) buf;
+    while(len)
+    {
+        ssize_t n = write(fd, p, len);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static const uint32_t NO_ID = UINT32_MAX;
+
+/* an index being put together, before it is written */
+struct index_data
+{
+    vector<index_dir>    dirs;
+    vector<string>       dir_paths;
+    vector<uint32_t>     prev_dirs;     // per directory, the same one in the previous index or NO_ID
+    vector<index_entry>  entries;
+    string               names;
+};
+
+static int entry_add(index_data &data, uint32_t dir, const char *name, size_t len, uint8_t type,
+                     uint32_t prev_dir, string &err_msg)
+{
+    if(data.names.size() + len + 1 > UINT32_MAX || data.entries.size() >= UINT32_MAX)
+    {
+        err_msg = "Too many names to index!!";
+        return FAILURE;
+    }
+    data.entries.pb({dir, (uint32_t) data.names.size(), (uint16_t) len, type, 0});
+    data.names.append(name, len);
+    data.names += '\0';
+
+    if(type == DT_DIR)
+    {
+        data.dirs.pb({dir, (uint32_t) (data.entries.size() - 1), 0, 0, 0});
+        data.dir_paths.pb(path_join(data.dir_paths[dir], name));
+        data.prev_dirs.pb(prev_dir);
+    }
+    return SUCCESS;
+}
+
+/* reads the directory d of data from the disk; sub-directories that were
+ * in the previous index as well are matched to it by name
+ */
+static int dir_read(index_data &data, uint32_t d, const index_view *prev, const vector<uint64_t> &prev_first,
+                    const vector<uint32_t> &prev_entry_dir, string &err_msg)
+{
+    /* stat'ed by path first, exactly the way the validation will do it */
+    struct stat dir_stat;
+    if(FAILURE == stat(data.dir_paths[d].c_str(), &dir_stat))
+        return SUCCESS;
+    data.dirs[d].mtime_sec = dir_stat.st_mtim.tv_sec;
+    data.dirs[d].mtime_nsec = dir_stat.st_mtim.tv_nsec;
+    data.dirs[d].ino = dir_stat.st_ino;
+
+    int dir_fd = open(data.dir_paths[d].c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(FAILURE == dir_fd)
+        return SUCCESS;         // unreadable directory, indexed as empty
+
+    unordered_map<string, uint32_t> prev_sub_dirs;
+    uint32_t p = data.prev_dirs[d];
+    if(prev && p != NO_ID)
+    {
+        for(uint64_t e = prev_first[p]; e < prev_first[p + 1]; ++e)
+            if(prev_entry_dir[e] != NO_ID)
+                prev_sub_dirs[prev->names + prev->entries[e].name_off] = prev_entry_dir[e];
+    }
+
+    dirent_stream ds(dir_fd, 256 * 1024);
+    const char *name;
+    unsigned char type;
+    ino_t ino;
+    while(ds.next(name, type, ino))
+    {
+        if(type == DT_UNKNOWN)
+        {
+            struct stat entry_stat;
+            if(SUCCESS == fstatat(dir_fd, name, &entry_stat, AT_SYMLINK_NOFOLLOW))
+                type = IFTODT(entry_stat.st_mode);
+        }
+
+        uint32_t prev_dir = NO_ID;
+        if(type == DT_DIR && !prev_sub_dirs.empty())
+        {
+            auto itr = prev_sub_dirs.find(name);
+            if(itr != prev_sub_dirs.end())
+                prev_dir = itr->second;
+        }
+        if(FAILURE == entry_add(data, d, name, strlen(name), type, prev_dir, err_msg))
+        {
+            close(dir_fd);
+            return FAILURE;
+        }
+    }
+    close(dir_fd);
+    return SUCCESS;
+}
+
+static int index_write(const index_data &data, const vector<uint32_t> &sorted, const string &index_path,
+                       string &err_msg)
+{
+    index_header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, index_magic, sizeof(index_magic));
+    hdr.n_dirs = data.dirs.size();
+    hdr.n_entries = data.entries.size();
+    hdr.dirs_off = align8(sizeof(hdr));
+    hdr.entries_off = align8(hdr.dirs_off + data.dirs.size() * sizeof(index_dir));
+    hdr.sorted_off = align8(hdr.entries_off + data.entries.size() * sizeof(index_entry));
+    hdr.names_off = align8(hdr.sorted_off + sorted.size() * sizeof(uint32_t));
+    hdr.names_size = data.names.size();
+
+    /* written aside and renamed, so a reader never maps a partial index */
+    string tmp_path = index_path + ".tmp";
+    int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if(FAILURE == fd)
+    {
+        err_msg = "open failed for " + tmp_path + "!! errno: " + to_string(errno);
+        return FAILURE;
+    }
+
+    const char zeros[8] = {0};
+    bool ok = write_all(fd, &hdr, sizeof(hdr)) &&
+              write_all(fd, zeros, hdr.dirs_off - sizeof(hdr)) &&
+              write_all(fd, data.dirs.data(), data.dirs.size() * sizeof(index_dir)) &&
+              write_all(fd, zeros, hdr.entries_off - (hdr.dirs_off + data.dirs.size() * sizeof(index_dir))) &&
+              write_all(fd, data.entries.data(), data.entries.size() * sizeof(index_entry)) &&
+              write_all(fd, zeros, hdr.sorted_off - (hdr.entries_off + data.entries.size() * sizeof(index_entry))) &&
+              write_all(fd, sorted.data(), sorted.size() * sizeof(uint32_t)) &&
+              write_all(fd, zeros, hdr.names_off - (hdr.sorted_off + sorted.size() * sizeof(uint32_t))) &&
+              write_all(fd, data.names.data(), data.names.size());
+    close(fd);
+
+    if(!ok || FAILURE == rename(tmp_path.c_str(), index_path.c_str()))
+    {
+        err_msg = "Writing the index " + index_path + " failed!! errno: " + to_string(errno);
+        unlink(tmp_path.c_str());
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+/* walks root_path breadth first and writes a new index file for it. With a
+ * prev index only the directories flagged in stale, and the ones new since,
+ * are read from the disk; the entries of every other directory are taken
+ * over from prev, and so is their order in sorted[].
+ */
+static int index_build(const string &root_path, const string &index_path, const index_view *prev,
+                       const vector<char> &stale, string &err_msg)
+{
+    if(FAILURE == access(root_path.c_str(), F_OK))
+    {
+        err_msg = "stat failed for " + root_path + "!! errno: " + to_string(errno);
+        return FAILURE;
+    }
+
+    /* where the entries of each previous directory start, and the directory
+     * each previous entry names; entries are stored directory by directory
+     */
+    vector<uint64_t> prev_first;
+    vector<uint32_t> prev_entry_dir, prev_to_new;
+    if(prev)
+    {
+        prev_first.assign(prev->hdr->n_dirs + 1, prev->hdr->n_entries);
+        for(uint64_t e = prev->hdr->n_entries; e-- > 0; )
+            prev_first[prev->entries[e].dir] = e;
+        for(uint32_t d = prev->hdr->n_dirs; d-- > 0; )
+            prev_first[d] = min(prev_first[d], prev_first[d + 1]);
+        prev_entry_dir.assign(prev->hdr->n_entries, NO_ID);
+        for(uint32_t d = 1; d < prev->hdr->n_dirs; ++d)
+            prev_entry_dir[prev->dirs[d].entry] = d;
+        prev_to_new.assign(prev->hdr->n_entries, NO_ID);
+    }
+
+    index_data data;
+    data.dirs.pb({0, 0, 0, 0, 0});
+    data.dir_paths.pb(root_path);
+    data.prev_dirs.pb(prev ? 0 : NO_ID);
+
+    for(size_t d = 0; d < data.dirs.size(); ++d)
+    {
+        uint32_t p = data.prev_dirs[d];
+        if(!prev || p == NO_ID || stale[p])
+        {
+            if(FAILURE == dir_read(data, d, prev, prev_first, prev_entry_dir, err_msg))
+                return FAILURE;
+            continue;
+        }
+
+        /* unchanged since the previous index */
+        data.dirs[d].mtime_sec = prev->dirs[p].mtime_sec;
+        data.dirs[d].mtime_nsec = prev->dirs[p].mtime_nsec;
+        data.dirs[d].ino = prev->dirs[p].ino;
+        for(uint64_t e = prev_first[p]; e < prev_first[p + 1]; ++e)
+        {
+            const index_entry &entry = prev->entries[e];
+            prev_to_new[e] = data.entries.size();
+            if(FAILURE == entry_add(data, d, prev->names + entry.name_off, entry.name_len, entry.type,
+                                    prev_entry_dir[e], err_msg))
+                return FAILURE;
+        }
+    }
+
+    /* the entries taken over keep their order, only the ones read now are
+     * sorted and merged in
+     */
+    const char *names_base = data.names.data();
+    auto name_less = [&data, names_base](uint32_t a, uint32_t b)
+    {
+        return strcmp(names_base + data.entries[a].name_off, names_base + data.entries[b].name_off) < 0;
+    };
+    vector<uint32_t> kept, fresh;
+    vector<char> is_kept(data.entries.size(), 0);
+    if(prev)
+    {
+        for(uint64_t i = 0; i < prev->hdr->n_entries; ++i)
+        {
+            uint32_t id = prev_to_new[prev->sorted[i]];
+            if(id != NO_ID)
+            {
+                kept.pb(id);
+                is_kept[id] = 1;
+            }
+        }
+    }
+    for(uint32_t id = 0; id < data.entries.size(); ++id)
+        if(!is_kept[id])
+            fresh.pb(id);
+    sort(fresh.begin(), fresh.end(), name_less);
+
+    vector<uint32_t> sorted(data.entries.size());
+    merge(kept.begin(), kept.end(), fresh.begin(), fresh.end(), sorted.begin(), name_less);
+    return index_write(data, sorted, index_path, err_msg);
+}
+
+/* makes cached_view a valid mapping of the index of root_path, bringing the
+ * index up to date first if a directory changed
+ */
+static int view_get(const string &root_path, vector<string> &dir_paths, string &err_msg)
+{
+    string index_path = index_path_get(root_path);
+
+    if(cached_view.map && cached_view.root_path != root_path)
+        view_unmap(cached_view);
+    if(!cached_view.map)
+        view_map(index_path, root_path, cached_view);
+
+    int ret;
+    if(cached_view.map)
+    {
+        vector<char> stale;
+        dir_paths_get(cached_view, dir_paths);
+        if(0 == dirs_stale_get(cached_view, dir_paths, stale))
+            return SUCCESS;
+        ret = index_build(root_path, index_path, &cached_view, stale, err_msg);
+        view_unmap(cached_view);
+    }
+    else
+    {
+        ret = index_build(root_path, index_path, NULL, vector<char>(), err_msg);
+    }
+    if(FAILURE == ret)
+        return FAILURE;
+
+    if(FAILURE == view_map(index_path, root_path, cached_view))
+    {
+        err_msg = "Mapping the index " + index_path + " failed!!";
+        return FAILURE;
+    }
+    dir_paths_get(cached_view, dir_paths);
+    return SUCCESS;
+}
+
+int name_index_search(const string &root_path, int match, const string &query,
+                      vector<string> &paths, string &err_msg)
+{
+    string root = root_path;
+    while(root.length() > 1 && root[root.length() - 1] == '/')
+        root.erase(root.length() - 1);
+
+    vector<string> dir_paths;
+    if(FAILURE == view_get(root, dir_paths, err_msg))
+        return FAILURE;
+
+    const index_view &view = cached_view;
+    const char *q = query.c_str();
+    size_t q_len = query.length();
+    vector<uint32_t> hits;
+
+    if(match == INDEX_SUBSTR)
+    {
+        for(uint64_t i = 0; i < view.hdr->n_entries; ++i)
+        {
+            const index_entry &entry = view.entries[i];
+            if(entry.name_len >= q_len && memmem(view.names + entry.name_off, entry.name_len, q, q_len))
+                hits.pb(i);
+        }
+    }
+    else
+    {
+        /* the matches of an exact or prefix query are one run of sorted[] */
+        const uint32_t *first = view.sorted, *last = view.sorted + view.hdr->n_entries;
+        const uint32_t *itr = lower_bound(first, last, q, [&view](uint32_t id, const char *key)
+        {
+            return strcmp(view.names + view.entries[id].name_off, key) < 0;
+        });
+        for(; itr != last; ++itr)
+        {
+            const index_entry &entry = view.entries[*itr];
+            const char *name = view.names + entry.name_off;
+            if(strncmp(name, q, q_len))
+                break;
+            if(match == INDEX_EXACT && entry.name_len != q_len)
+                break;
+            hits.pb(*itr);
+        }
+    }
+
+    paths.clear();
+    for(uint32_t id : hits)
+    {
+        const index_entry &entry = view.entries[id];
+        paths.pb(path_join(dir_paths[entry.dir], view.names + entry.name_off));
+    }
+    sort(paths.begin(), paths.end());
+    return SUCCESS;
+}
@@ -0,0 +1,20 @@
+#ifndef _NAME_INDEX_H_
+#define _NAME_INDEX_H_
+
+#include <string>
+#include <vector>
+
+#define INDEX_EXACT     0       // name equals the query
+#define INDEX_PREFIX    1       // name starts with the query
+#define INDEX_SUBSTR    2       // name contains the query
+
+/* persistent filename index of a directory tree, kept in
+ * ~/.cache/bhavi-file-explorer/. It is built on the first search of a tree
+ * and memory-mapped on later ones; the mtime recorded for every directory
+ * is checked before answering. Only the directories found changed are
+ * read again, the rest of the index is carried over into the new one.
+ */
+int name_index_search(const std::string &root_path, int match, const std::string &query,
+                      std::vector<std::string> &paths, std::string &err_msg);
+
+#endif
@@ -2,8 +2,6 @@
 #include <cstdio>
 #include <cstdlib>
 #include <time.h>
-#include <pwd.h>
-#include <grp.h>
 #include <termios.h>
 #include <unistd.h>
 #include <signal.h>
@@ -13,9 +11,19 @@
 #include "command_mode.h"
 #include "normal_mode.h"
 #include "common.h"
+#include "dir_scan.h"
+#include "name_cache.h"
+#include "render.h"
+#include "search_walk.h"
+#include "dir_watch.h"
+#include "listing_cache.h"
+#include "jobs.h"
+#include "dir_size.h"
+#include "stats.h"
 #include "includes.h"
 
 #include <iomanip>         // setprecision
+#include <vector>
 
 using namespace std;
 
@@ -24,8 +32,7 @@ using namespace std;
 #define ONE_M          (1024*1024)
 #define ONE_G          (1024*1024*1024)
 #define CHILD          0
-
-#define l_citr(T) list<T>::const_iterator
+#define NO_POS         ((size_t) -1)
 
 extern struct winsize w;
 
@@ -40,46 +47,89 @@ struct termios prev_attr, new_attr;
 stack<string> bwd_stack;
 stack<string> fwd_stack;
 
-list<dir_content> content_list;
-static l_citr(dir_content) start_itr;
-static l_citr(dir_content) prev_selection_itr;
-static l_citr(dir_content) selection_itr;
+content_store content_list;
+static size_t start_pos;                    // first row on the screen
+static size_t prev_selection_pos;           // NO_POS if none
+static size_t selection_pos;
 int bottom_limit, top_limit;
 bool is_search_content;
+static bool is_search_running;
+static int sort_mode = SORT_NAME;
+static bool is_dir_size_on;              // directories show the size of everything below them
+static string sized_dir;                 // directory whose sub-directories are being summed up
+static string listed_dir;                // directory whose listing content_list holds
+static listing_stamp listed_stamp;      // its state when the listing was built
+
+static void listing_cache_save();
+static bool listing_cache_restore();
+static void content_line_print(const string &line, const string &attr);
+static void listing_sort();
+static void dir_sizes_request();
+
+static const char *sort_names[SORT_MODES] = {"name", "natural name", "size", "mtime", "type", "extension"};
 
 Mode current_mode;
 
 void print_highlighted_line()
 {
     int saved_cursor_r_pos = cursor_r_pos;
-    cout << "\033[1;33;105m";
-    ranked_content_line_print(selection_itr);
-    cout << "\033[0m";
+    ranked_content_line_print(selection_pos, "\033[1;33;105m");
     cursor_r_pos = saved_cursor_r_pos;
-    cursor_init();
+    render_frame_emit(cursor_r_pos, cursor_c_pos);
 }
 
 void cursor_init()
 {
-    cout << "\033[" << cursor_r_pos << ";" << cursor_c_pos << "H";
-    cout.flush();
+    term_write("\033[" + to_string(cursor_r_pos) + ";" + to_string(cursor_c_pos) + "H");
 }
 
-/* prints the directory contents by wrapping the line according to 
- * window width
+/* the line shown for a row, built when it is drawn */
+string content_line_at(size_t pos)
+{
+    if(content_list.is_text(pos))
+        return content_list.name(pos);
+
+    scan_entry entry;
+    content_list.entry_get(pos, entry);
+    if(is_dir_size_on && entry.stat_ok && S_ISDIR(entry.mode) && entry.name != "." && entry.name != "..")
+    {
+        if(!content_list.has_total(pos))
+            return content_line_get(entry, "     ...");      // still being summed up
+        entry.size = content_list.total(pos);
+    }
+    return content_line_get(entry);
+}
+
+/* screen rows a line takes at the current window width */
+static int line_rows_get(const string &line)
+{
+    return max(1, (int) ((line.length() + w.ws_col - 1) / w.ws_col));
+}
+
+int content_rows_get(size_t pos)
+{
+    return line_rows_get(content_line_at(pos));
+}
+
+/* puts the directory contents in the screen rows starting at cursor_r_pos,
+ * wrapping the line according to window width
  */
-void ranked_content_line_print(list<dir_content>::const_iterator itr)
+void ranked_content_line_print(size_t pos, const string &attr)
 {
-    int i;
-    for(i = 0; i < itr->no_lines - 1; ++i)
+    content_line_print(content_line_at(pos), attr);
+}
+
+static void content_line_print(const string &line, const string &attr)
+{
+    int no_lines = line_rows_get(line);
+    for(int i = 0; i < no_lines; ++i)
     {
-        cout << itr->content_line.substr((i*w.ws_col), (i+1)*w.ws_col);
+        string row = line.substr(i*w.ws_col, w.ws_col);
+        if(!attr.empty())
+            row = attr + row + "\033[0m";
+        render_row_set(cursor_r_pos, row);
         ++cursor_r_pos;
-        cursor_init();
     }
-    cout << itr->content_line.substr(i*w.ws_col);
-    ++cursor_r_pos;
-    cursor_init();
 }
 
 /* moves the cursor up or down
@@ -95,51 +145,46 @@ bool move_cursor_r(int r, int dr)
     }
     else if(dr < 0)     // move up
     {
-        if(selection_itr == content_list.begin())
+        if(selection_pos == 0)
             return false;
 
-        prev_selection_itr = selection_itr;
-        --selection_itr;
+        prev_selection_pos = selection_pos;
+        --selection_pos;
 
         if(r + dr >= top_limit)
         {
-            ranked_content_line_print(prev_selection_itr);
-            cursor_r_pos = r - selection_itr->no_lines;
-            cursor_init();
+            ranked_content_line_print(prev_selection_pos);
+            cursor_r_pos = r - content_rows_get(selection_pos);
         }
         else
         {
-            --start_itr;
+            --start_pos;
             ret = true;
         }
     }
     else if(dr > 0)     // move down
     {
-        ++selection_itr;
-        if(selection_itr == content_list.end())
-        {
-            --selection_itr;
+        if(selection_pos + 1 >= content_list.size())
             return false;
-        }
 
-        --selection_itr;
-        prev_selection_itr = selection_itr;
-        ++selection_itr;
+        prev_selection_pos = selection_pos;
+        ++selection_pos;
 
-        if(r + prev_selection_itr->no_lines <= bottom_limit)
+        int prev_rows = content_rows_get(prev_selection_pos);
+        if(r + prev_rows <= bottom_limit)
         {
-            ranked_content_line_print(prev_selection_itr);
-            cursor_r_pos = r + prev_selection_itr->no_lines;
-            cursor_init();
+            ranked_content_line_print(prev_selection_pos);
+            cursor_r_pos = r + prev_rows;
         }
         else
         {
             /* decides the entries to be skipped from the top if scroll down is done
              *  and the next entry is spanned over multiple lines
              */
-            for(int sum = 0; sum < selection_itr->no_lines; ++start_itr)
+            int selection_rows = content_rows_get(selection_pos);
+            for(int sum = 0; sum < selection_rows; ++start_pos)
             {
-                sum += start_itr->no_lines;
+                sum += content_rows_get(start_pos);
             }
             ret = true;
         }
@@ -150,8 +195,8 @@ bool move_cursor_r(int r, int dr)
 
 void screen_clear()
 {
-    cout << "\033[3J" << "\033[H\033[J";
-    cout.flush();
+    term_write("\033[3J\033[H\033[J");
+    render_blank();
     cursor_r_pos = cursor_c_pos = 1;
     cursor_init();
 }
@@ -189,20 +234,21 @@ string human_readable_size_get(off_t size)
 }
 
 /* return all the information of a file/directory as a string */
-string content_line_get(string abs_path)
+string content_line_get(const scan_entry &entry, const string &size_str)
 {
-    struct stat dir_entry_stat;          // to retrive the stats of the file/directory
-    struct passwd *pUser;            // to determine the file/directory owner
-    struct group *pGroup;            // to determine the file/directory group
-
+    stat_scope sc(STAT_CONTENT_LINE_GET);
     string last_modified_time;
 
-    stat(abs_path.c_str(), &dir_entry_stat);      // retrieve information about the entry
-
     stringstream ss;
+    if(!entry.stat_ok)
+    {
+        ss << "??????????" << "  " << left << setw(12) << "?" << "  " << setw(12) << "?";
+        ss << " " << right << setw(8) << "?" << "  " << setw(24) << "?" << "  " << entry.name;
+        return ss.str();
+    }
 
     // [file-type] [permissions] [owner] [group] [size in bytes] [time of last modification] [filename]
-    switch (dir_entry_stat.st_mode & S_IFMT) {
+    switch (entry.mode & S_IFMT) {
         case S_IFBLK:  ss << "b"; break;
         case S_IFCHR:  ss << "c"; break;
         case S_IFDIR:  ss << "d"; break; // It's a (sub)directory
@@ -214,36 +260,33 @@ string content_line_get(string abs_path)
 
     // [permissions]
     // http://linux.die.net/man/2/chmod
-    ss << ((dir_entry_stat.st_mode & S_IRUSR) ? "r" : "-");
-    ss << ((dir_entry_stat.st_mode & S_IWUSR) ? "w" : "-");
-    ss << ((dir_entry_stat.st_mode & S_IXUSR) ? "x" : "-");
-    ss << ((dir_entry_stat.st_mode & S_IRGRP) ? "r" : "-");
-    ss << ((dir_entry_stat.st_mode & S_IWGRP) ? "w" : "-");
-    ss << ((dir_entry_stat.st_mode & S_IXGRP) ? "x" : "-");
-    ss << ((dir_entry_stat.st_mode & S_IROTH) ? "r" : "-");
-    ss << ((dir_entry_stat.st_mode & S_IWOTH) ? "w" : "-");
-    ss << ((dir_entry_stat.st_mode & S_IXOTH) ? "x" : "-");
+    ss << ((entry.mode & S_IRUSR) ? "r" : "-");
+    ss << ((entry.mode & S_IWUSR) ? "w" : "-");
+    ss << ((entry.mode & S_IXUSR) ? "x" : "-");
+    ss << ((entry.mode & S_IRGRP) ? "r" : "-");
+    ss << ((entry.mode & S_IWGRP) ? "w" : "-");
+    ss << ((entry.mode & S_IXGRP) ? "x" : "-");
+    ss << ((entry.mode & S_IROTH) ? "r" : "-");
+    ss << ((entry.mode & S_IWOTH) ? "w" : "-");
+    ss << ((entry.mode & S_IXOTH) ? "x" : "-");
 
 
     // [owner]
     // http://linux.die.net/man/3/getpwuid
-    pUser = getpwuid(dir_entry_stat.st_uid);
-    ss << "  " << left << setw(12) << pUser->pw_name;
+    ss << "  " << left << setw(12) << user_name_get(entry.uid);
 
     // [group]
     // http://linux.die.net/man/3/getgrgid
-    pGroup = getgrgid(dir_entry_stat.st_gid);
-    ss << "  " << setw(12) << pGroup->gr_name;
+    ss << "  " << setw(12) << group_name_get(entry.gid);
 
     // [size in bytes] [time of last modification] [filename]
-    ss << " " << human_readable_size_get(dir_entry_stat.st_size);
+    ss << " " << (size_str.empty() ? human_readable_size_get(entry.size) : size_str);
 
-    last_modified_time = ctime(&dir_entry_stat.st_mtime);
+    last_modified_time = ctime(&entry.mtime);
     last_modified_time[last_modified_time.length() - 1] = '\0';
     ss << "  " << last_modified_time;
 
-    size_t fwd_slash_pos = abs_path.find_last_of("/");
-    ss << "  " << abs_path.substr(fwd_slash_pos + 1);
+    ss << "  " << entry.name;
 
     return ss.str();
 }
@@ -251,47 +294,32 @@ string content_line_get(string abs_path)
 /* creates the information list of all sub-directories and files in a directory */
 void content_list_create()
 {
-    struct dirent **dir_entry_arr;
-    struct dirent *dir_entry;
+    stat_scope sc(STAT_CONTENT_LIST_CREATE);
+    vector<scan_entry> entries;
 
-    string last_modified_time, dir_entry_path;
+    /* watched before the scan so that no change falls in between */
+    if(SUCCESS == dir_watch_start(working_dir))
+        input_source_add(dir_watch_fd(), listing_events_apply);
 
-    int n = scandir(working_dir.c_str(), &dir_entry_arr, NULL, alphasort);
-    if(n == FAILURE)
+    listing_stamp_get(working_dir, listed_stamp);
+    listed_dir.clear();
+    if(FAILURE == dir_scan(working_dir, entries, SCAN_DOTS | SCAN_POOL))
     {
-        cout << "Scandir() failed!!\n";
+        term_write("Scandir() failed!!\n");
+        render_invalidate();
         return;
     }
 
+    size_t n_bytes = 1;
+    for(auto &entry : entries)
+        n_bytes += entry.name.length() + 1;
     content_list.clear();
-    for(int i = 0; i < n; ++i)
-    {
-        dir_entry = dir_entry_arr[i];
-
-        if(((string)dir_entry->d_name) != "." && ((string)dir_entry->d_name) != ".." &&
-           dir_entry->d_name[0] == '.')
-        {
-            continue;
-        }
-
-        dir_content dc;
-        dc.name = dir_entry->d_name;
-        dc.content_line = content_line_get(working_dir + dir_entry->d_name);
-        if(dc.content_line.length() % w.ws_col)
-        {
-            dc.no_lines = (dc.content_line.length() / w.ws_col) + 1;
-        }
-        else
-        {
-            dc.no_lines = (dc.content_line.length() / w.ws_col);
-        }
-        content_list.pb(dc);
-
-        free(dir_entry_arr[i]);
-        dir_entry_arr[i] = NULL;
-    }
-    free(dir_entry_arr);
-    dir_entry_arr = NULL;
+    content_list.reserve(entries.size(), n_bytes);
+    for(auto &entry : entries)
+        content_list.entry_add(entry);
+    content_list.sort(sort_mode);
+    listed_dir = working_dir;
+    dir_sizes_request();
 }
 
 /* prints the current mode in the status bar
@@ -310,7 +338,16 @@ void print_mode()
         case MODE_NORMAL:
         default:
             ss << "[NORMAL MODE]";
-            cout << "\033[1;33;40m" << ss.str() << "\033[0m" << " ";
+            term_write("\033[1;33;40m" + ss.str() + "\033[0m" + " ");
+            {
+                /* progress of the background job, cut to the screen width */
+                string job_status = jobs_status_get();
+                int room = (int)w.ws_col - (int)ss.str().length() - 2;
+                if(room > 0 && (int)job_status.length() > room)
+                    job_status.erase(room);
+                if(room > 0)
+                    term_write(job_status);
+            }
 
 #if 0
             if(is_status_pending)
@@ -318,13 +355,11 @@ void print_mode()
                 cout << "\033[1;31m" << status_str << "\033[0m";
             }
 #endif
-            cout.flush();
             break;
 
         case MODE_COMMAND:
             ss << "[COMMAND MODE] :";
-            cout << "\033[1;33;40m" << ss.str() << "\033[0m" << " ";
-            cout.flush();
+            term_write("\033[1;33;40m" + ss.str() + "\033[0m" + " ");
             break;
     }
     if(current_mode == MODE_COMMAND)
@@ -335,14 +370,18 @@ void print_mode()
     }
 }
 
-/* prints the list of information of a directory */
-pair<int, int> content_list_print(list<dir_content>::const_iterator itr)
+/* lays out the list of information of a directory in the screen rows */
+pair<int, int> content_list_print(size_t pos)
 {
+    stat_scope sc(STAT_CONTENT_LIST_PRINT);
     string pwd_str;
     int nWin_rows = w.ws_row;
     int pwd_rank, num_extra_entries = 0;
     bool selected_line_printed = false;
-    screen_clear();
+
+    render_resize(w.ws_row - BOTTOM_OFFSET);
+    render_rows_clear();
+    cursor_r_pos = cursor_c_pos = 1;
 
     int nRows_printed;
     stringstream ss;
@@ -350,68 +389,427 @@ pair<int, int> content_list_print(list<dir_content>::const_iterator itr)
         ss << "PWD: ~/";
     else
         ss << "PWD: ~/" << working_dir.substr(root_dir.length());
+    if(!is_search_content && sort_mode != SORT_NAME)
+        ss << "    [sorted by " << sort_names[sort_mode] << "]";
 
     if(ss.str().length() % w.ws_col)
         pwd_rank = (ss.str().length() / w.ws_col) + 1;
     else
         pwd_rank = (ss.str().length() / w.ws_col);
 
-    int i = 0;
-    for(; i < pwd_rank - 1; ++i)
+    for(int i = 0; i < pwd_rank; ++i)
     {
-        cout << "\033[1;33;40m" << ss.str().substr((i*w.ws_col), (i+1)*w.ws_col) << "\033[0m";
+        render_row_set(cursor_r_pos, "\033[1;33;40m" + ss.str().substr(i*w.ws_col, w.ws_col) + "\033[0m");
         ++cursor_r_pos;
-        cursor_init();
     }
-    cout << "\033[1;33;40m" << ss.str().substr(i*w.ws_col) << "\033[0m";
-    ++cursor_r_pos;
-    cursor_init();
     top_limit = cursor_r_pos;
 
-    for(nRows_printed = cursor_r_pos-1; itr != content_list.end(); ++itr)
+    for(nRows_printed = cursor_r_pos-1; pos < content_list.size(); ++pos)
     {
-        if(itr->no_lines > nWin_rows - nRows_printed - BOTTOM_OFFSET)
+        string line = content_line_at(pos);     // only the rows that fit are ever built
+        if(line_rows_get(line) > nWin_rows - nRows_printed - BOTTOM_OFFSET)
             break;
 
         if(selected_line_printed)
             ++num_extra_entries;
 
-        if(itr == selection_itr)
+        if(pos == selection_pos)
             selected_line_printed = true;
 
-        for(i = 0; i < itr->no_lines - 1; ++i)
-        {
-            cout << itr->content_line.substr((i*w.ws_col), (i+1)*w.ws_col);
-            ++cursor_r_pos;
-            cursor_init();
-        }
-        cout << itr->content_line.substr(i*w.ws_col);
-        ++cursor_r_pos;
-        cursor_init();
+        content_line_print(line, "");
         nRows_printed = cursor_r_pos - 1;
     }
-    print_mode();
+    render_scroll_region_set(top_limit, nWin_rows - BOTTOM_OFFSET);
+    if(current_mode == MODE_NORMAL)     // a command being typed stays on the status bar
+        print_mode();
     return make_pair(nRows_printed, num_extra_entries+1);
 }
 
-/* clears screen and prints the entire list again */
+/* rebuilds the screen and sends whatever changed on it */
 void display_refresh()
 {
+    if(!is_search_content && listed_dir != working_dir)
+    {
+        listing_cache_save();
+        if(listing_cache_restore())
+        {
+            display_update();
+            return;
+        }
+    }
     if(!is_search_content)
         content_list_create();
 
-    start_itr = content_list.begin();
-    selection_itr = start_itr;
-    prev_selection_itr = content_list.end();
+    start_pos = selection_pos = 0;
+    prev_selection_pos = NO_POS;
 
-    auto p = content_list_print(start_itr);
+    auto p = content_list_print(start_pos);
     bottom_limit = p.first;
     if(current_mode == MODE_NORMAL)
     {
         cursor_r_pos = top_limit;
-        cursor_init();
         print_highlighted_line();
     }
+    else
+    {
+        print_mode();
+        render_frame_emit(cursor_r_pos, cursor_c_pos);
+    }
+}
+
+/* repaints the listing after it was edited in place, keeping the selection
+ * and scrolling just enough to keep it in view
+ */
+void display_update()
+{
+    int saved_cursor_r_pos = cursor_r_pos, saved_cursor_c_pos = cursor_c_pos;
+    if(start_pos > selection_pos)
+        start_pos = selection_pos;
+
+    /* rows from the top of the screen to the selection, counted backwards
+     * so that only rows that fit on the screen are ever laid out
+     */
+    int nRows_visible = w.ws_row - BOTTOM_OFFSET - top_limit + 1;
+    int rows = content_rows_get(selection_pos);
+    size_t pos = selection_pos;
+    while(pos > start_pos)
+    {
+        int pos_rows = content_rows_get(pos - 1);
+        if(rows + pos_rows > nRows_visible)
+            break;
+        rows += pos_rows;
+        --pos;
+    }
+    start_pos = pos;
+    cursor_r_pos = top_limit + rows - content_rows_get(selection_pos);
+
+    int selection_r_pos = cursor_r_pos;
+    auto p = content_list_print(start_pos);
+    bottom_limit = p.first;
+    if(current_mode == MODE_NORMAL)
+    {
+        cursor_r_pos = selection_r_pos;
+        print_highlighted_line();
+    }
+    else
+    {
+        /* the cursor goes back to the command being typed */
+        cursor_r_pos = saved_cursor_r_pos;
+        cursor_c_pos = saved_cursor_c_pos;
+        render_frame_emit(cursor_r_pos, cursor_c_pos);
+    }
+}
+
+/* a command changed files: the directory watch brings the changes into the
+ * listing, a full refresh is only needed without it
+ */
+void listing_changed()
+{
+    if(listed_dir != working_dir || !dir_watch_active())
+        display_refresh();
+}
+
+/* the rows after pos move up by one; a selection on pos moves to the row
+ * that takes its place, or to the one before at the end
+ */
+static void content_entry_erase(size_t pos)
+{
+    content_list.erase(pos);
+    if(selection_pos > pos || (selection_pos == pos && selection_pos == content_list.size() && pos))
+        --selection_pos;
+    if(start_pos > pos || (start_pos == pos && start_pos == content_list.size() && pos))
+        --start_pos;
+    prev_selection_pos = NO_POS;
+}
+
+/* a row whose attributes changed moves to where they now put it, the
+ * selection going along
+ */
+static void content_entry_update(size_t pos, const scan_entry &entry)
+{
+    content_list.erase(pos);
+    size_t new_pos = content_list.sorted_pos(entry);
+    content_list.entry_insert(new_pos, entry);
+
+    for(size_t *row : {&selection_pos, &start_pos})
+    {
+        if(*row == pos)
+            *row = new_pos;
+        else if(*row > pos && *row <= new_pos)
+            --*row;
+        else if(*row < pos && *row >= new_pos)
+            ++*row;
+    }
+    prev_selection_pos = NO_POS;
+}
+
+static void content_entry_insert(size_t pos, const scan_entry &entry)
+{
+    content_list.entry_insert(pos, entry);
+    if(selection_pos >= pos && content_list.size() > 1)
+        ++selection_pos;
+    if(start_pos >= pos && content_list.size() > 1)
+        ++start_pos;
+    prev_selection_pos = NO_POS;
+}
+
+/* brings the pending events of the directory watch into the listing,
+ * returns false if they were too many or the directory went away
+ */
+static bool listing_events_merge()
+{
+    vector<dir_event> events;
+    dir_watch_events_get(events);
+    if(events.empty())
+        return true;
+    if(events[0].kind == DIR_EVENT_RESCAN)
+        return false;
+
+    for(auto &ev : events)
+    {
+        if(ev.name[0] == '.')       // hidden entries are not listed
+            continue;
+
+        size_t pos = content_list.find(ev.name.c_str());
+        bool listed = (pos < content_list.size());
+
+        scan_entry entry;
+        if(ev.kind == DIR_EVENT_REMOVE || FAILURE == dir_entry_scan(listed_dir, ev.name, entry))
+        {
+            if(listed)
+                content_entry_erase(pos);
+        }
+        else if(listed)
+        {
+            content_entry_update(pos, entry);
+        }
+        else
+        {
+            content_entry_insert(content_list.sorted_pos(entry), entry);
+        }
+    }
+
+    /* the directory's own line shows its new mtime; it stays on top */
+    scan_entry entry;
+    size_t pos = content_list.find(".");
+    if(pos < content_list.size() && SUCCESS == dir_entry_scan(listed_dir, ".", entry))
+        content_list.entry_set(pos, entry);
+    return true;
+}
+
+/* applies the pending events of the directory watch to the listing */
+void listing_events_apply(int fd)
+{
+    if(listed_dir != working_dir)
+    {
+        vector<dir_event> events;
+        dir_watch_events_get(events);       // nothing to apply them to
+        return;
+    }
+
+    if(listing_events_merge())
+    {
+        dir_sizes_request();        // for the directories that changed
+        display_update();
+    }
+    else
+    {
+        display_refresh();
+    }
+}
+
+/* moves the listing on the screen into the listing cache, from where going
+ * back to its directory restores it
+ */
+static void listing_cache_save()
+{
+    if(listed_dir.empty() || content_list.empty())
+        return;
+
+    /* with a watch, the listing is current up to now: stamp first, then take
+     * the events that came before the stamp
+     */
+    if(dir_watch_active())
+    {
+        if(FAILURE == listing_stamp_get(listed_dir, listed_stamp) || !listing_events_merge())
+            return;
+    }
+
+    cached_listing cl;
+    cl.stamp = listed_stamp;
+    cl.start_pos = start_pos;
+    cl.selection_pos = selection_pos;
+    cl.contents.swap(content_list);
+    listing_cache_put(listed_dir, cl);
+    listed_dir.clear();
+}
+
+/* makes the cached listing of the working directory the current one */
+static bool listing_cache_restore()
+{
+    /* watched before the check so that no change falls in between */
+    if(SUCCESS == dir_watch_start(working_dir))
+        input_source_add(dir_watch_fd(), listing_events_apply);
+
+    cached_listing cl;
+    if(!listing_cache_take(working_dir, cl))
+        return false;
+
+    content_list.swap(cl.contents);
+    start_pos = cl.start_pos;
+    selection_pos = cl.selection_pos;
+    prev_selection_pos = NO_POS;
+    /* totals may have changed deep down, where no watch looked; the size
+     * cache makes summing up unchanged subtrees again cheap
+     */
+    content_list.totals_clear();
+    if(content_list.sort_mode() != sort_mode)
+        listing_sort();
+    listed_dir = working_dir;
+    listed_stamp = cl.stamp;
+    dir_sizes_request();
+    return true;
+}
+
+/* puts the listing in the current sort mode without reading the directory
+ * again; the selected entry stays selected
+ */
+static void listing_sort()
+{
+    string selected_name = content_list.empty() ? "" : content_list.name(selection_pos);
+    content_list.sort(sort_mode);
+    selection_pos = content_list.find(selected_name.c_str());
+    if(selection_pos >= content_list.size())
+        selection_pos = 0;
+    prev_selection_pos = NO_POS;        // display_update() scrolls to the selection
+}
+
+/* fills in the totals that came in for the listed directory */
+void dir_sizes_update(int fd)
+{
+    vector<dir_size_result> results;
+    if(!dir_size_drain(results))
+        input_source_remove(fd);
+    if(results.empty() || sized_dir != listed_dir || !is_dir_size_on)
+        return;
+
+    for(auto &result : results)
+    {
+        size_t pos = content_list.find(result.name.c_str());
+        if(pos < content_list.size())
+            content_list.total_set(pos, result.bytes);
+    }
+    if(sort_mode == SORT_SIZE)
+        listing_sort();
+    display_update();
+}
+
+/* starts summing up the directories of the listing that have no total yet */
+static void dir_sizes_request()
+{
+    vector<string> names;
+    if(is_dir_size_on && !listed_dir.empty())
+    {
+        scan_entry entry;
+        for(size_t pos = 0; pos < content_list.size(); ++pos)
+        {
+            if(content_list.has_total(pos))
+                continue;
+            content_list.entry_get(pos, entry);
+            if(entry.stat_ok && S_ISDIR(entry.mode) && entry.name != "." && entry.name != "..")
+                names.pb(entry.name);
+        }
+    }
+    if(names.empty())
+    {
+        dir_size_cancel();
+        input_source_remove(dir_size_fd());
+        return;
+    }
+
+    sized_dir = listed_dir;
+    dir_size_start(listed_dir, names);
+    input_source_add(dir_size_fd(), dir_sizes_update);
+}
+
+/* the listing gives way to other contents (e.g. search results) */
+void listing_discard()
+{
+    listing_cache_save();
+    listed_dir.clear();
+    content_list.clear();
+}
+
+/* appends the matches a running search walk found since the last call and
+ * repaints the listing if they can be seen
+ */
+void search_results_update(int fd)
+{
+    vector<search_hit> hits;
+    bool running = search_walk_drain(hits);
+    if(!running)
+        search_stop();
+
+    if(!is_search_content)
+        return;
+    for(auto &hit : hits)
+        search_result_add(hit.path, hit.where);
+
+    if(hits.empty() || current_mode != MODE_NORMAL)
+        return;
+
+    int saved_cursor_r_pos = cursor_r_pos;
+    auto p = content_list_print(start_pos);
+    bottom_limit = p.first;
+    cursor_r_pos = saved_cursor_r_pos;
+    print_highlighted_line();
+}
+
+/* keeps the listing fed with the matches of the running search walk */
+void search_results_follow()
+{
+    is_search_running = true;
+    input_source_add(search_walk_fd(), search_results_update);
+}
+
+void search_stop()
+{
+    if(!is_search_running)
+        return;
+
+    is_search_running = false;
+    input_source_remove(search_walk_fd());
+    search_walk_cancel();
+}
+
+/* repaints the job progress in the status line; once a job has finished
+ * the listing is brought up to date, should no watch have seen its changes
+ */
+void jobs_status_update(int fd)
+{
+    static unsigned int n_finished_seen;
+
+    uint64_t expirations;
+    while(read(fd, &expirations, sizeof(expirations)) < 0 && errno == EINTR);
+
+    if(current_mode != MODE_NORMAL)
+        return;
+
+    unsigned int n_finished = jobs_finished_count();
+    if(n_finished != n_finished_seen)
+    {
+        n_finished_seen = n_finished;
+        if(dupes_results_take())
+            display_refresh();
+        else if(!is_search_content)
+            listing_changed();
+    }
+
+    int saved_cursor_r_pos = cursor_r_pos, saved_cursor_c_pos = cursor_c_pos;
+    print_mode();
+    cursor_r_pos = saved_cursor_r_pos;
+    cursor_c_pos = saved_cursor_c_pos;
+    cursor_init();
 }
 
 /* launches a file by forking a child process and using xdg-open */
@@ -431,12 +829,40 @@ void launch_file(string file_path)
     }
 }
 
+/* moves the selection one entry up (dr < 0) or down, scrolling the
+ * listing when it leaves the screen
+ */
+static void selection_step(int dr)
+{
+    if(dr < 0)
+    {
+        if(move_cursor_r(cursor_r_pos, -1))
+        {
+            content_list_print(start_pos);
+            cursor_r_pos = top_limit;
+        }
+    }
+    else if(move_cursor_r(cursor_r_pos, 1))
+    {
+        auto p = content_list_print(start_pos);
+        bottom_limit = p.first;
+        cursor_r_pos = bottom_limit + 1;
+        for(int i = 0; i < p.second; ++i)
+        {
+            cursor_r_pos -= content_rows_get(selection_pos + i);
+        }
+    }
+    print_highlighted_line();
+}
+
 int enter_normal_mode()
 {
     bool explorer_exit = false;
     current_mode = MODE_NORMAL;
 
     ioctl(0, TIOCGWINSZ, &w);
+    screen_clear();
+    input_source_add(jobs_fd(), jobs_status_update);
 
     while(!explorer_exit)
     {
@@ -460,11 +886,17 @@ int enter_normal_mode()
             {
                 case ESC:
                 {
+                    if(is_search_running)       // ESC first stops a running search
+                    {
+                        search_stop();
+                        break;
+                    }
+
                     bool done = false;
                     while(!done)
                     {
                         screen_clear();
-                        cout << "\033[1;33;40m" << "Exit File Explorer? (y/n):" << "\033[0m" << " ";
+                        term_write("\033[1;33;40mExit File Explorer? (y/n):\033[0m ");
                         ch = next_input_char_get();
                         switch(ch)
                         {
@@ -486,30 +918,25 @@ int enter_normal_mode()
                 }
 
                 case UP:
-                    if(move_cursor_r(cursor_r_pos, -1))
-                    {
-                        content_list_print(start_itr);
-                        cursor_r_pos = top_limit;
-                        cursor_init();
-                    }
-                    print_highlighted_line();
-                    break;
-
                 case DOWN:
-                    if(move_cursor_r(cursor_r_pos, 1))
+                {
+                    /* a held arrow key comes faster than the listing is drawn:
+                     * the repeats already waiting move the selection at once
+                     */
+                    size_t n_moves = 1 + key_repeats_take(ch);
+                    if(n_moves == 1 || content_list.empty())
                     {
-                        auto p = content_list_print(start_itr);
-                        bottom_limit = p.first;
-                        cursor_r_pos = bottom_limit + 1;
-                        auto itr = selection_itr;
-                        for(int i = 0; i < p.second; ++i, ++itr)
-                        {
-                            cursor_r_pos -= itr->no_lines;
-                        }
-                        cursor_init();
+                        selection_step(ch == UP ? -1 : 1);
+                        break;
                     }
-                    print_highlighted_line();
+                    if(ch == UP)
+                        selection_pos -= min(selection_pos, n_moves);
+                    else
+                        selection_pos = min(content_list.size() - 1, selection_pos + n_moves);
+                    prev_selection_pos = NO_POS;
+                    display_update();
                     break;
+                }
 
                 case RIGHT:
                     if(!fwd_stack.empty())
@@ -529,16 +956,19 @@ int enter_normal_mode()
                         bwd_stack.pop();
                     }
                     if(is_search_content)
+                    {
+                        search_stop();
                         is_search_content = false;
+                    }
 
                     refresh_dir = true;
                     break;
 
                 case ENTER:
-                    if(selection_itr->name == ".")
+                    if(content_list.empty() || !strcmp(content_list.name(selection_pos), "."))
                         continue;
 
-                    if(selection_itr->name == "..")
+                    if(!strcmp(content_list.name(selection_pos), ".."))
                     {
                         if(working_dir != root_dir)
                         {
@@ -557,14 +987,16 @@ int enter_normal_mode()
 
                         if(is_search_content)
                         {
-                            size_t fwd_slash_pos = (selection_itr->content_line).find_first_of("/");
-                            selected_str = root_dir + (selection_itr->content_line).substr(fwd_slash_pos + 1);
+                            selected_str = content_list.path(selection_pos);
+                            if(FAILURE == access(selected_str.c_str(), F_OK))       // e.g. removed since
+                                continue;
 
                             if(is_directory(selected_str))
                             {
                                 stack_clear(fwd_stack);
                                 bwd_stack.push(working_dir);
                                 working_dir = selected_str + "/";
+                                search_stop();
                                 is_search_content = false;
                                 refresh_dir = true;
                             }
@@ -575,7 +1007,7 @@ int enter_normal_mode()
                         }
                         else
                         {
-                            selected_str = working_dir + selection_itr->name;
+                            selected_str = working_dir + content_list.name(selection_pos);
                             if(is_directory(selected_str))
                             {
                                 stack_clear(fwd_stack);
@@ -591,6 +1023,69 @@ int enter_normal_mode()
                     }
                     break;
 
+                /* next sort mode */
+                case 's':
+                case 'S':
+                    if(is_search_content)
+                        break;
+                    sort_mode = (sort_mode + 1) % SORT_MODES;
+                    if(listed_dir == working_dir)
+                    {
+                        listing_sort();
+                        display_update();
+                    }
+                    else
+                    {
+                        refresh_dir = true;
+                    }
+                    break;
+
+                /* recursive directory sizes on/off */
+                case 'd':           // not 'D', which is what LEFT arrives as
+                    if(is_search_content)
+                        break;
+                    is_dir_size_on = !is_dir_size_on;
+                    if(listed_dir != working_dir)
+                    {
+                        refresh_dir = true;
+                        break;
+                    }
+                    if(!is_dir_size_on)
+                    {
+                        content_list.totals_clear();
+                        if(sort_mode == SORT_SIZE)
+                            listing_sort();
+                    }
+                    dir_sizes_request();
+                    display_update();
+                    break;
+
+                /* deletes the selected file of a result list, e.g. a duplicate */
+                case 'x':
+                case 'X':
+                {
+                    if(!is_search_content || content_list.empty())
+                        break;
+
+                    string selected_str = content_list.path(selection_pos);
+                    struct stat selected_stat;
+                    if(selected_str.empty() || FAILURE == lstat(selected_str.c_str(), &selected_stat) ||
+                       S_ISDIR(selected_stat.st_mode))
+                        break;
+
+                    cursor_r_pos = w.ws_row;
+                    cursor_c_pos = 1;
+                    cursor_init();
+                    from_cursor_line_clear();
+                    string prompt = "Delete " + selected_str.substr(selected_str.find_last_of("/") + 1) + "? (y/n):";
+                    term_write("\033[1;33;40m" + prompt.substr(0, max((int)w.ws_col - 1, 0)) + "\033[0m ");
+                    ch = next_input_char_get();
+                    if((ch == 'y' || ch == 'Y') && SUCCESS == unlink(selected_str.c_str()))
+                        content_entry_erase(selection_pos);
+                    display_update();
+                    break;
+                }
+
                 /* HOME */
                 case 'h':
                 case 'H':
@@ -622,7 +1117,13 @@ int enter_normal_mode()
                 case COLON:
                 {
                     enter_command_mode();
-                    refresh_dir = true;
+                    dupes_results_take();       // a dupes job that finished meanwhile
+
+                    /* the watch kept the listing current, no need to rescan it */
+                    if(!is_search_content && listed_dir == working_dir && dir_watch_active())
+                        display_update();
+                    else
+                        refresh_dir = true;
                     break;
                 }
 
@@ -632,27 +1133,6 @@ int enter_normal_mode()
         }
     }
     screen_clear();
+    term_flush();
     return SUCCESS;
 }
-
-int main(int argc, char* argv[])
-{
-    //cin.get();
-    signal (SIGWINCH, win_resize_handler);
-
-    tcgetattr(STDIN_FILENO, &prev_attr);
-    new_attr = prev_attr;
-    new_attr.c_lflag &= ~ICANON;
-    new_attr.c_lflag &= ~ECHO;
-    tcsetattr( STDIN_FILENO, TCSANOW, &new_attr);
-
-    root_dir = getenv("PWD");
-    if(root_dir != "/")
-        root_dir = root_dir + "/";
-    working_dir = root_dir;
-
-    enter_normal_mode();
-
-    tcsetattr( STDIN_FILENO, TCSANOW, &prev_attr);
-
-}
@@ -5,28 +5,33 @@
 #include <list>
 #include <cstdio>
 #include <utility>
+#include "content_store.h"
 
-struct dir_content
-{
-    int no_lines;
-    std::string name;
-    std::string content_line;
-
-    dir_content(): no_lines(1) {}
-};
+struct scan_entry;
 
 void print_highlighted_line();
 void cursor_init();
-void ranked_content_line_print(std::list<dir_content>::const_iterator);
+std::string content_line_at(size_t);
+int content_rows_get(size_t);
+void ranked_content_line_print(size_t, const std::string &attr = "");
 bool move_cursor_r(int, int);
 void screen_clear();
 std::string human_readable_size_get(off_t);
-std::string content_line_get(std::string);
+std::string content_line_get(const scan_entry&, const std::string &size_str = "");
 void content_list_create();
 void print_mode();
-std::pair<int, int> content_list_print(std::list<dir_content>::const_iterator);
+std::pair<int, int> content_list_print(size_t);
 void display_refresh();
+void display_update();
+void listing_changed();
+void listing_events_apply(int);
+void listing_discard();
 void launch_file(std::string);
+void search_results_update(int);
+void search_results_follow();
+void search_stop();
+void jobs_status_update(int);
+void dir_sizes_update(int);
 int enter_normal_mode();
 
 #endif
@@ -0,0 +1,164 @@
+#include "render.h"
+#include "common.h"
+#include "stats.h"
+#include "includes.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+using namespace std;
+
+static string          term_buf;
+
+static vector<string>  back_rows;
+static vector<string>  front_rows;
+static int             scroll_top;      // 1-based, inclusive
+static int             scroll_bottom;
+
+/* a row content no real row can have, marks rows whose screen content is unknown */
+static const string    row_unknown("\x01");
+
+void term_write(const string &s)
+{
+    term_buf += s;
+}
+
+void term_flush()
+{
+    if(term_buf.empty())
+        return;
+
+    stat_scope sc(STAT_TERM_FLUSH);
+    sc.bytes_add(term_buf.length());
+    size_t done = 0;
+    while(done < term_buf.length())
+    {
+        ssize_t n = write(STDOUT_FILENO, term_buf.data() + done, term_buf.length() - done);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            break;
+        done += n;
+    }
+    term_buf.clear();
+}
+
+void render_resize(int rows)
+{
+    if(rows < 0)
+        rows = 0;
+    if(rows == (int) back_rows.size())
+        return;
+
+    back_rows.assign(rows, "");
+    front_rows.assign(rows, row_unknown);
+    scroll_top = scroll_bottom = 0;
+}
+
+void render_rows_clear()
+{
+    for(auto &row : back_rows)
+        row.clear();
+}
+
+void render_row_set(int row, const string &text)
+{
+    if(row >= 1 && row <= (int) back_rows.size())
+        back_rows[row - 1] = text;
+}
+
+void render_scroll_region_set(int top, int bottom)
+{
+    scroll_top = max(top, 1);
+    scroll_bottom = min(bottom, (int) back_rows.size());
+}
+
+/* the terminal content can no longer be trusted, next frame repaints all */
+void render_invalidate()
+{
+    for(auto &row : front_rows)
+        row = row_unknown;
+}
+
+/* the terminal was just cleared */
+void render_blank()
+{
+    for(auto &row : front_rows)
+        row.clear();
+}
+
+/* number of region rows that would already be right if the terminal
+ * content were shifted up by n rows (down for negative n)
+ */
+static int shifted_matches_get(int n)
+{
+    int matches = 0;
+    for(int r = scroll_top - 1; r < scroll_bottom; ++r)
+    {
+        int from = r + n;
+        if(from >= scroll_top - 1 && from < scroll_bottom && front_rows[from] != row_unknown &&
+           front_rows[from] == back_rows[r])
+            ++matches;
+    }
+    return matches;
+}
+
+/* scrolls the region when that saves repainting rows */
+static void region_scroll()
+{
+    int height = scroll_bottom - scroll_top + 1;
+    if(height < 2)
+        return;
+
+    int best_n = 0, best_matches = shifted_matches_get(0);
+    for(int n = 1; n < height; ++n)
+    {
+        for(int dir : {1, -1})
+        {
+            int matches = shifted_matches_get(n * dir);
+            if(matches > best_matches)
+            {
+                best_matches = matches;
+                best_n = n * dir;
+            }
+        }
+    }
+    if(best_n == 0)
+        return;
+
+    int n = abs(best_n);
+    term_write("\033[0m\033[" + to_string(scroll_top) + ";" + to_string(scroll_bottom) + "r");
+    term_write("\033[" + to_string(n) + (best_n > 0 ? "S" : "T"));
+    term_write("\033[r");
+
+    int top = scroll_top - 1, bottom = scroll_bottom - 1;
+    if(best_n > 0)
+    {
+        for(int r = top; r <= bottom; ++r)
+            front_rows[r] = (r + n <= bottom) ? move(front_rows[r + n]) : string();
+    }
+    else
+    {
+        for(int r = bottom; r >= top; --r)
+            front_rows[r] = (r - n >= top) ? move(front_rows[r - n]) : string();
+    }
+}
+
+void render_frame_emit(int cursor_r, int cursor_c)
+{
+    stat_scope sc(STAT_FRAME_EMIT);
+    if(scroll_top >= 1 && scroll_bottom > scroll_top)
+        region_scroll();
+
+    for(unsigned int r = 0; r < back_rows.size(); ++r)
+    {
+        if(back_rows[r] == front_rows[r])
+            continue;
+
+        /* clear first: clearing after a full-width row would eat its last column */
+        term_write("\033[" + to_string(r + 1) + ";1H\033[0m\033[K" + back_rows[r]);
+        front_rows[r] = back_rows[r];
+    }
+    term_write("\033[" + to_string(cursor_r) + ";" + to_string(cursor_c) + "H");
+}
@@ -0,0 +1,26 @@
+#ifndef _RENDER_H_
+#define _RENDER_H_
+
+#include <string>
+
+/* every escape sequence and character meant for the terminal is collected
+ * here and sent with a single write() by term_flush(), which is done right
+ * before blocking for the next key
+ */
+void term_write(const std::string &s);
+void term_flush();
+
+/* back-buffer of the listing rows (every row but the status bar). Rows are
+ * filled with render_row_set() and render_frame_emit() sends only the rows
+ * that differ from what the terminal shows, using the scroll region to
+ * shift rows instead of repainting them.
+ */
+void render_resize(int rows);
+void render_rows_clear();
+void render_row_set(int row, const std::string &text);
+void render_scroll_region_set(int top, int bottom);
+void render_frame_emit(int cursor_r, int cursor_c);
+void render_invalidate();
+void render_blank();
+
+#endif
@@ -0,0 +1,336 @@
+#include "search_walk.h"
+#include "dir_scan.h"
+#include "thread_pool.h"
+#include "common.h"
+#include "includes.h"
+
+#include <algorithm>
+#include <atomic>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <mutex>
+#include <poll.h>
+#include <regex.h>
+#include <sys/eventfd.h>
+#include <thread>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+/* state of the running walk */
+struct walk_ctx
+{
+    int                 kind;
+    string              pattern;
+    regex_t             re;
+    work_group          grp;
+    atomic<bool>        cancelled;
+    atomic<bool>        done;
+    atomic<bool>        notified;
+    mutex               match_lock;
+    vector<search_hit>  matches;
+};
+
+static walk_ctx   *walk;
+static thread      walk_driver;
+static int         walk_event_fd = FAILURE;
+
+static void walk_notify(walk_ctx &ctx)
+{
+    if(!ctx.notified.exchange(true))
+    {
+        uint64_t one = 1;
+        if(write(walk_event_fd, &one, sizeof(one)) < 0)
+            ctx.notified = false;
+    }
+}
+
+static bool name_matches(walk_ctx &ctx, const char *name)
+{
+    if(ctx.kind == SEARCH_REGEX)
+        return SUCCESS == regexec(&ctx.re, name, 0, NULL, 0);
+    return SUCCESS == fnmatch(ctx.pattern.c_str(), name, 0);
+}
+
+static void hits_add(walk_ctx &ctx, vector<search_hit> &found)
+{
+    if(found.empty())
+        return;
+    {
+        lock_guard<mutex> lk(ctx.match_lock);
+        for(auto &hit : found)
+            ctx.matches.pb(move(hit));
+    }
+    walk_notify(ctx);
+}
+
+/* first occurrence of needle in hay. With SSE2, 16 positions at a time are
+ * tested for the first and the last byte of needle and only where both
+ * match is the rest compared; memchr() finds the candidates otherwise.
+ */
+static const char* literal_find(const char *hay, size_t len, const char *needle, size_t n)
+{
+    if(n > len)
+        return NULL;
+    if(n == 1)
+        return (const char*) memchr(hay, needle[0], len);
+
+#ifdef __SSE2__
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[n - 1]);
+    size_t i = 0;
+    for(; i + n - 1 + 16 <= len; i += 16)
+    {
+        __m128i block_first = _mm_loadu_si128((const __m128i*) (hay + i));
+        __m128i block_last = _mm_loadu_si128((const __m128i*) (hay + i + n - 1));
+        unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, block_first),
+                                                            _mm_cmpeq_epi8(last, block_last)));
+        while(mask)
+        {
+            int bit = __builtin_ctz(mask);
+            if(!memcmp(hay + i + bit + 1, needle + 1, n - 2))
+                return hay + i + bit;
+            mask &= mask - 1;
+        }
+    }
+    hay += i;
+    len -= i;
+#endif
+
+    while(len >= n)
+    {
+        const char *p = (const char*) memchr(hay, needle[0], len - n + 1);
+        if(!p)
+            return NULL;
+        if(!memcmp(p, needle, n))
+            return p;
+        len -= p + 1 - hay;
+        hay = p + 1;
+    }
+    return NULL;
+}
+
+/* the part of a matching line shown in the results, control characters
+ * blanked out so they cannot reach the terminal
+ */
+static string line_text_get(const char *line_begin, const char *line_end, const char *match)
+{
+    string text;
+    if(match - line_begin > GREP_LINE_SHOWN / 2)
+    {
+        text = "...";
+        line_begin = match - GREP_LINE_SHOWN / 4;
+    }
+    text.append(line_begin, min(line_end - line_begin, (long) GREP_LINE_SHOWN));
+    for(auto &c : text)
+        if((unsigned char) c < ' ' || c == 0x7f)
+            c = ' ';
+    return text;
+}
+
+/* reports the lines of data[0, len) holding the pattern, each once.
+ * Returns the number of the line data ends in
+ */
+static long buffer_grep(walk_ctx &ctx, const string &path, const char *data, size_t len, long line_no,
+                        vector<search_hit> &found)
+{
+    const char *p = data, *end = data + len, *counted = data;
+    while(p < end && !ctx.cancelled)
+    {
+        const char *match = literal_find(p, end - p, ctx.pattern.data(), ctx.pattern.length());
+        if(!match)
+            break;
+        line_no += count(counted, match, '\n');
+        counted = match;
+
+        const char *line_begin = match, *line_end = (const char*) memchr(match, '\n', end - match);
+        while(line_begin > data && line_begin[-1] != '\n')
+            --line_begin;
+        if(!line_end)
+            line_end = end;
+        found.pb({path, to_string(line_no) + ": " + line_text_get(line_begin, line_end, match)});
+        p = line_end + 1;
+    }
+    return line_no + count(counted, end, '\n');
+}
+
+/* greps a regular file read in GREP_CHUNK_SIZE chunks, each cut at its
+ * last line end; the partial line is carried over into the next one. A
+ * line longer than GREP_LINE_MAX is grepped in pieces of that size, so the
+ * carry stays bounded. A NUL byte among the first GREP_TEXT_CHECK bytes
+ * marks the file binary and it is skipped. The file is read rather than
+ * mapped: another process truncating it must not kill the explorer.
+ */
+static void file_grep_task(walk_ctx &ctx, const string &path)
+{
+    if(ctx.cancelled)
+        return;
+
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if(FAILURE == fd)
+        return;
+    struct stat st;
+    if(FAILURE == fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size == 0)
+    {
+        close(fd);
+        return;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    vector<search_hit> found;
+    vector<char> buf(GREP_CHUNK_SIZE);
+    size_t carry = 0;
+    long line_no = 1;
+    bool first = true;
+    while(!ctx.cancelled)
+    {
+        if(buf.size() < carry + GREP_CHUNK_SIZE)
+            buf.resize(carry + GREP_CHUNK_SIZE);
+        ssize_t n = read(fd, buf.data() + carry, GREP_CHUNK_SIZE);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+        {
+            buffer_grep(ctx, path, buf.data(), carry, line_no, found);
+            break;
+        }
+        if(first && memchr(buf.data(), '\0', min((ssize_t) GREP_TEXT_CHECK, n)))
+            break;
+        first = false;
+
+        /* only the bytes just read can hold a new line end */
+        size_t len = carry + n;
+        const char *last_nl = (const char*) memrchr(buf.data() + carry, '\n', n);
+        size_t done = last_nl ? last_nl + 1 - buf.data() : 0;
+        if(!done && len >= GREP_LINE_MAX)
+            done = len;
+        line_no = buffer_grep(ctx, path, buf.data(), done, line_no, found);
+        carry = len - done;
+        memmove(buf.data(), buf.data() + done, carry);
+    }
+    close(fd);
+    hits_add(ctx, found);
+}
+
+static void dir_search_task(walk_ctx &ctx, const string &dir_path)
+{
+    if(ctx.cancelled)
+        return;
+
+    int dir_fd = open(dir_path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(FAILURE == dir_fd)
+        return;
+
+    vector<search_hit> found;
+    work_pool &pool = pool_get();
+    dirent_stream ds(dir_fd);
+    const char *name;
+    unsigned char type;
+    ino_t ino;
+    while(!ctx.cancelled && ds.next(name, type, ino))
+    {
+        string path = (dir_path == "/" ? "" : dir_path) + "/" + name;
+        if(ctx.kind != SEARCH_CONTENT && name_matches(ctx, name))
+            found.pb({path, ""});
+
+        if(type == DT_UNKNOWN)
+        {
+            struct stat entry_stat;
+            if(SUCCESS == fstatat(dir_fd, name, &entry_stat, AT_SYMLINK_NOFOLLOW))
+                type = IFTODT(entry_stat.st_mode);
+        }
+        if(type == DT_DIR)
+            pool.submit(ctx.grp, [&ctx, path] { dir_search_task(ctx, path); });
+        else if(type == DT_REG && ctx.kind == SEARCH_CONTENT)
+            pool.submit(ctx.grp, [&ctx, path] { file_grep_task(ctx, path); });
+    }
+    close(dir_fd);
+    hits_add(ctx, found);
+}
+
+int search_walk_start(const string &root_path, const string &pattern, int kind, string &err_msg)
+{
+    search_walk_cancel();
+
+    if(FAILURE == walk_event_fd)
+        walk_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    walk_ctx *ctx = new walk_ctx;
+    ctx->kind = kind;
+    ctx->pattern = pattern;
+    ctx->cancelled = ctx->done = ctx->notified = false;
+    if(kind == SEARCH_REGEX && SUCCESS != regcomp(&ctx->re, pattern.c_str(), REG_EXTENDED | REG_NOSUB))
+    {
+        err_msg = "Invalid regular expression!!";
+        delete ctx;
+        return FAILURE;
+    }
+
+    string root = root_path;
+    while(root.length() > 1 && root[root.length() - 1] == '/')
+        root.erase(root.length() - 1);
+
+    walk = ctx;
+    walk_driver = thread([ctx, root]
+    {
+        work_pool &pool = pool_get();
+        pool.submit(ctx->grp, [ctx, root] { dir_search_task(*ctx, root); });
+        pool.wait(ctx->grp);
+        ctx->done = true;
+        walk_notify(*ctx);
+    });
+    return SUCCESS;
+}
+
+int search_walk_fd()
+{
+    return walk_event_fd;
+}
+
+/* moves the matches found so far into hits, returns true while the walk
+ * is still running
+ */
+bool search_walk_drain(vector<search_hit> &hits)
+{
+    if(!walk)
+        return false;
+
+    uint64_t count;
+    if(read(walk_event_fd, &count, sizeof(count)) > 0)
+        walk->notified = false;
+
+    bool running = !walk->done;
+    lock_guard<mutex> lk(walk->match_lock);
+    for(auto &hit : walk->matches)
+        hits.pb(move(hit));
+    walk->matches.clear();
+    return running;
+}
+
+/* waits until matches are waiting or the walk is over */
+bool search_walk_wait(int timeout_ms)
+{
+    if(!walk)
+        return false;
+
+    struct pollfd pfd = {walk_event_fd, POLLIN, 0};
+    return poll(&pfd, 1, timeout_ms) > 0;
+}
+
+void search_walk_cancel()
+{
+    if(!walk)
+        return;
+
+    walk->cancelled = true;
+    walk_driver.join();
+    if(walk->kind == SEARCH_REGEX)
+        regfree(&walk->re);
+    delete walk;
+    walk = NULL;
+
+    uint64_t count;
+    while(read(walk_event_fd, &count, sizeof(count)) > 0);
+}
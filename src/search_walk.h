@@ -0,0 +1,34 @@
+#ifndef _SEARCH_WALK_H_
+#define _SEARCH_WALK_H_
+
+#include <string>
+#include <vector>
+
+#define SEARCH_GLOB     0
+#define SEARCH_REGEX    1
+#define SEARCH_CONTENT  2               // lines of regular files containing a fixed string
+
+#define GREP_TEXT_CHECK 8192            // leading bytes checked for a NUL, which marks a file binary
+#define GREP_CHUNK_SIZE (1 << 20)
+#define GREP_LINE_MAX   (4 << 20)       // longer lines are grepped in pieces of this size
+#define GREP_LINE_SHOWN 160             // characters of a matching line kept around the match
+
+struct search_hit
+{
+    std::string  path;
+    std::string  where;                 // "<line>: <text>" of a content match, else empty
+};
+
+/* parallel walk of a directory tree matching entry names against a glob or
+ * an extended regular expression, or the contents of its files against a
+ * fixed string. Matches are collected as they are found; search_walk_fd()
+ * becomes readable whenever new ones are waiting.
+ * Only one walk runs at a time, starting a new one cancels the previous.
+ */
+int  search_walk_start(const std::string &root_path, const std::string &pattern, int kind, std::string &err_msg);
+int  search_walk_fd();
+bool search_walk_drain(std::vector<search_hit> &hits);
+bool search_walk_wait(int timeout_ms);
+void search_walk_cancel();
+
+#endif
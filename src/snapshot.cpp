@@ -0,0 +1,717 @@
+#include "snapshot.h"
+#include "dir_scan.h"
+#include "thread_pool.h"
+#include "stats.h"
+#include "common.h"
+#include "includes.h"
+
+#include <algorithm>
+#include <deque>
+#include <fcntl.h>
+#include <memory>
+#include <unordered_map>
+#include <sys/mman.h>
+
+using namespace std;
+
+/* on-disk layout of the binary format, every record 8-byte aligned:
+ *   snap_header | { snap_dir_rec, path | { snap_entry_rec, name }... }...
+ * The directories and their entries come in the same order as in the text
+ * format. entries_size lets a reader skip a directory; the counts in the
+ * header are filled in once the walk is done.
+ */
+static const char snap_magic[8] = {'B', 'F', 'X', 'S', 'N', 'A', 'P', '1'};
+
+struct snap_header
+{
+    char      magic[8];
+    uint64_t  n_dirs;
+    uint64_t  n_entries;
+};
+
+struct snap_dir_rec
+{
+    uint32_t  path_len;
+    uint32_t  n_entries;
+    uint64_t  entries_size;     // bytes of entry records following the path
+    uint64_t  ino;
+    int64_t   mtime_sec;
+    int64_t   mtime_nsec;
+};
+
+struct snap_entry_rec
+{
+    uint16_t  name_len;
+    uint8_t   type;
+    uint8_t   pad;
+    uint32_t  mtime_nsec;
+    uint64_t  size;
+    int64_t   mtime_sec;
+    uint64_t  ino;
+};
+
+static uint64_t align8(uint64_t off)
+{
+    return (off + 7) & ~(uint64_t) 7;
+}
+
+/* one directory of the walk, read by a pool worker ahead of the writer */
+struct snap_node
+{
+    string                  rel_path;
+    uint64_t                ino;
+    struct timespec         mtime;
+    vector<snapshot_entry>  entries;
+    int                     err;
+    bool                    queued;
+    bool                    reused;
+    work_group              grp;
+
+    snap_node(const string &path): rel_path(path), ino(0), mtime(), err(0), queued(false), reused(false) {}
+};
+
+/* the previous snapshot of an incremental one, with the offset of every
+ * directory record by path
+ */
+struct snap_prev
+{
+    snapshot_reader                  rd;
+    unordered_map<string, size_t>    dir_offs;
+};
+
+/* the dump file behind one large buffer */
+class snap_out
+{
+public:
+    snap_out(int fd): fd(fd), buf(1024 * 1024), len(0), err(0) {}
+
+    void put(const void *data, size_t size)
+    {
+        if(len + size > buf.size())
+            flush();
+        if(size > buf.size())
+        {
+            raw_write((const char *) data, size);
+            return;
+        }
+        memcpy(buf.data() + len, data, size);
+        len += size;
+    }
+
+    void pad8(uint64_t written)
+    {
+        static const char zeros[8] = {0};
+        put(zeros, align8(written) - written);
+    }
+
+    void flush()
+    {
+        raw_write(buf.data(), len);
+        len = 0;
+    }
+
+    int error() const { return err; }
+
+private:
+    void raw_write(const char *data, size_t size)
+    {
+        while(size && !err)
+        {
+            ssize_t n = write(fd, data, size);
+            if(n < 0)
+            {
+                if(errno != EINTR)
+                    err = errno;
+                continue;
+            }
+            data += n;
+            size -= n;
+        }
+    }
+
+    int           fd;
+    vector<char>  buf;
+    size_t        len;
+    int           err;
+};
+
+/* takes the entries of a directory unchanged since the previous snapshot */
+static bool node_reuse(snap_node &node, const string &abs_path, const snap_prev &prev)
+{
+    auto itr = prev.dir_offs.find(node.rel_path);
+    if(itr == prev.dir_offs.end())
+        return false;
+
+    struct stat dir_stat;
+    snapshot_dir dir;
+    if(FAILURE == lstat(abs_path.c_str(), &dir_stat) || !S_ISDIR(dir_stat.st_mode) ||
+       !prev.rd.dir_read(itr->second, dir, node.entries))
+        return false;
+
+    if(dir.ino != dir_stat.st_ino || dir.mtime_sec != dir_stat.st_mtim.tv_sec ||
+       dir.mtime_nsec != dir_stat.st_mtim.tv_nsec)
+    {
+        node.entries.clear();
+        return false;
+    }
+    node.ino = dir.ino;
+    node.mtime = dir_stat.st_mtim;
+    node.reused = true;
+    return true;
+}
+
+/* reads one directory: names and types come from getdents64, the binary
+ * format also stats every entry relative to the directory
+ */
+static void node_scan(snap_node &node, const string &abs_path, int format, const snap_prev *prev)
+{
+    stat_scope sc(STAT_SNAPSHOT_DIR);
+    if(prev && node_reuse(node, abs_path, *prev))
+        return;
+
+    int dir_fd = open(abs_path.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if(FAILURE == dir_fd)
+    {
+        node.err = errno;
+        return;
+    }
+
+    struct stat dir_stat;
+    if(SUCCESS == fstat(dir_fd, &dir_stat))
+    {
+        node.ino = dir_stat.st_ino;
+        node.mtime = dir_stat.st_mtim;
+    }
+
+    dirent_stream ds(dir_fd, 256 * 1024);
+    const char *name;
+    unsigned char type;
+    ino_t ino;
+    while(ds.next(name, type, ino))
+    {
+        if(name[0] == '.')
+            continue;
+        node.entries.emplace_back();
+        snapshot_entry &entry = node.entries.back();
+        entry.name = name;
+        entry.type = type;
+        entry.ino = ino;
+        entry.size = 0;
+        entry.mtime_sec = 0;
+        entry.mtime_nsec = 0;
+    }
+    node.err = ds.error();
+
+    sort(node.entries.begin(), node.entries.end(), [](const snapshot_entry &a, const snapshot_entry &b)
+    {
+        return strcoll(a.name.c_str(), b.name.c_str()) < 0;
+    });
+
+    for(auto &entry : node.entries)
+    {
+        if(format == SNAPSHOT_TEXT && entry.type != DT_UNKNOWN)
+            continue;
+
+        struct statx stx;
+        if(SUCCESS != statx(dir_fd, entry.name.c_str(), AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC,
+                            STATX_TYPE | STATX_SIZE | STATX_MTIME, &stx))
+            continue;
+        entry.type = IFTODT(stx.stx_mode);
+        entry.size = stx.stx_size;
+        entry.mtime_sec = stx.stx_mtime.tv_sec;
+        entry.mtime_nsec = stx.stx_mtime.tv_nsec;
+    }
+    close(dir_fd);
+}
+
+static void node_write(snap_out &out, const snap_node &node, int format, uint64_t &written)
+{
+    if(format == SNAPSHOT_TEXT)
+    {
+        string line = node.rel_path + ":\n";
+        out.put(line.data(), line.size());
+        for(auto &entry : node.entries)
+        {
+            out.put(entry.name.data(), entry.name.size());
+            out.put("\n", 1);
+        }
+        out.put("\n", 1);
+        return;
+    }
+
+    snap_dir_rec dr = {};
+    dr.path_len = node.rel_path.size();
+    dr.n_entries = node.entries.size();
+    for(auto &entry : node.entries)
+        dr.entries_size += align8(sizeof(snap_entry_rec) + entry.name.size());
+    dr.ino = node.ino;
+    dr.mtime_sec = node.mtime.tv_sec;
+    dr.mtime_nsec = node.mtime.tv_nsec;
+
+    out.put(&dr, sizeof(dr));
+    out.put(node.rel_path.data(), node.rel_path.size());
+    written += sizeof(dr) + node.rel_path.size();
+    out.pad8(written);
+    written = align8(written);
+
+    for(auto &entry : node.entries)
+    {
+        snap_entry_rec er = {};
+        er.name_len = entry.name.size();
+        er.type = entry.type;
+        er.mtime_nsec = entry.mtime_nsec;
+        er.size = entry.size;
+        er.mtime_sec = entry.mtime_sec;
+        er.ino = entry.ino;
+
+        out.put(&er, sizeof(er));
+        out.put(entry.name.data(), entry.name.size());
+        written += sizeof(er) + entry.name.size();
+        out.pad8(written);
+        written = align8(written);
+    }
+}
+
+int snapshot_write(const string &folder_path, const string &dump_path, int format,
+                   const string &prev_path, snapshot_stats &stats, string &err_msg, op_ctl *ctl)
+{
+    stats = snapshot_stats();
+
+    unique_ptr<snap_prev> prev;
+    if(!prev_path.empty())
+    {
+        struct stat prev_stat, dump_stat;
+        if(SUCCESS == stat(prev_path.c_str(), &prev_stat) && SUCCESS == stat(dump_path.c_str(), &dump_stat) &&
+           prev_stat.st_dev == dump_stat.st_dev && prev_stat.st_ino == dump_stat.st_ino)
+        {
+            err_msg = "The dumpfile cannot be the previous snapshot!!";
+            return FAILURE;
+        }
+
+        prev.reset(new snap_prev);
+        if(FAILURE == prev->rd.open(prev_path, err_msg))
+            return FAILURE;
+        if(prev->rd.format() != SNAPSHOT_BINARY)
+        {
+            err_msg = prev_path + " is not a binary snapshot!!";
+            return FAILURE;
+        }
+
+        snapshot_dir dir;
+        while(prev->rd.next_dir(dir))
+            prev->dir_offs[dir.path] = prev->rd.dir_offset();
+    }
+
+    int dump_fd = open(dump_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if(FAILURE == dump_fd)
+    {
+        err_msg = "Unable to open " + dump_path + ": " + strerror(errno);
+        return FAILURE;
+    }
+
+    snap_out out(dump_fd);
+    uint64_t written = 0;
+    snap_header hdr = {};
+    if(format == SNAPSHOT_BINARY)
+    {
+        memcpy(hdr.magic, snap_magic, sizeof(snap_magic));
+        out.put(&hdr, sizeof(hdr));
+        written = sizeof(hdr);
+    }
+
+    /* the directories still to be written, in output order. The first
+     * SNAPSHOT_READ_AHEAD of them are read by the pool while the writer
+     * waits for the head.
+     */
+    work_pool &pool = pool_get();
+    deque<unique_ptr<snap_node>> pending;
+    pending.emplace_back(new snap_node("."));
+    bool cancelled = false;
+
+    while(!pending.empty())
+    {
+        if(ctl && !cancelled && !ctl->proceed())
+            cancelled = true;
+
+        size_t ahead = 0;
+        for(auto &node : pending)
+        {
+            if(ahead++ == SNAPSHOT_READ_AHEAD || out.error() || cancelled)
+                break;
+            if(node->queued)
+                continue;
+            node->queued = true;
+            snap_node *np = node.get();
+            string abs_path = folder_path + np->rel_path.substr(1);
+            snap_prev *pp = prev.get();
+            pool.submit(np->grp, [np, abs_path, format, pp] { node_scan(*np, abs_path, format, pp); });
+        }
+
+        unique_ptr<snap_node> node = move(pending.front());
+        pending.pop_front();
+        pool.wait(node->grp);
+
+        if(out.error() || cancelled)
+            continue;       // only waits for what was already handed out
+
+        node_write(out, *node, format, written);
+        ++stats.n_dirs;
+        stats.n_entries += node->entries.size();
+        if(node->err)
+            ++stats.n_unreadable;
+        if(node->reused)
+            ++stats.n_reused;
+        if(ctl)
+            ctl->files_done += node->entries.size();
+
+        for(auto itr = node->entries.rbegin(); itr != node->entries.rend(); ++itr)
+        {
+            if(itr->type == DT_DIR)
+                pending.emplace_front(new snap_node(node->rel_path + "/" + itr->name));
+        }
+    }
+    out.flush();
+
+    int err = out.error();
+    if(!err && format == SNAPSHOT_BINARY)
+    {
+        hdr.n_dirs = stats.n_dirs;
+        hdr.n_entries = stats.n_entries;
+        if(sizeof(hdr) != pwrite(dump_fd, &hdr, sizeof(hdr), 0))
+            err = errno ? errno : EIO;
+    }
+    if(FAILURE == close(dump_fd) && !err)
+        err = errno;
+    if(cancelled)
+    {
+        unlink(dump_path.c_str());
+        err_msg = "Cancelled";
+        return FAILURE;
+    }
+    if(err)
+    {
+        err_msg = "Unable to write " + dump_path + ": " + strerror(err);
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+/* orders directory paths the way the walk writes them: component by
+ * component, a directory before everything below it
+ */
+static int path_compare(const string &a, const string &b)
+{
+    size_t a_pos = 0, b_pos = 0;
+    while(a_pos < a.size() && b_pos < b.size())
+    {
+        size_t a_end = a.find('/', a_pos), b_end = b.find('/', b_pos);
+        if(a_end == string::npos)
+            a_end = a.size();
+        if(b_end == string::npos)
+            b_end = b.size();
+
+        int c = strcoll(a.substr(a_pos, a_end - a_pos).c_str(), b.substr(b_pos, b_end - b_pos).c_str());
+        if(c)
+            return c;
+        a_pos = a_end + 1;
+        b_pos = b_end + 1;
+    }
+    return (a_pos < a.size()) - (b_pos < b.size());
+}
+
+static bool entry_changed(const snapshot_entry &a, const snapshot_entry &b)
+{
+    if(a.type == DT_UNKNOWN || b.type == DT_UNKNOWN)       // a text snapshot knows only names
+        return false;
+    if(a.type != b.type)
+        return true;
+    if(a.type == DT_DIR)        // changes inside show up on their own
+        return false;
+    return a.size != b.size || a.mtime_sec != b.mtime_sec || a.mtime_nsec != b.mtime_nsec;
+}
+
+/* one side of the diff, checking that its directories come in order */
+struct diff_side
+{
+    snapshot_reader  rd;
+    string           path;
+    snapshot_dir     dir;
+    string           prev_dir;
+    bool             has_dir;
+    bool             unordered;
+
+    diff_side(): has_dir(false), unordered(false) {}
+
+    void dir_next()
+    {
+        prev_dir = dir.path;
+        has_dir = rd.next_dir(dir);
+        if(has_dir && !prev_dir.empty() && path_compare(prev_dir, dir.path) >= 0)
+        {
+            unordered = true;
+            has_dir = false;
+        }
+    }
+};
+
+int snapshot_diff(const string &old_path, const string &new_path, snapdiff_cb cb, string &err_msg)
+{
+    diff_side a, b;
+    if(FAILURE == a.rd.open(old_path, err_msg) || FAILURE == b.rd.open(new_path, err_msg))
+        return FAILURE;
+    a.path = old_path;
+    b.path = new_path;
+    a.dir_next();
+    b.dir_next();
+
+    snapshot_entry ea, eb;
+    while(a.has_dir || b.has_dir)
+    {
+        int c = !a.has_dir ? 1 : (!b.has_dir ? -1 : path_compare(a.dir.path, b.dir.path));
+        if(c < 0)
+        {
+            /* the directory is gone, so is all of it */
+            while(a.rd.next_entry(ea))
+                cb(SNAPDIFF_REMOVED, a.dir.path + "/" + ea.name);
+            a.dir_next();
+        }
+        else if(c > 0)
+        {
+            while(b.rd.next_entry(eb))
+                cb(SNAPDIFF_ADDED, b.dir.path + "/" + eb.name);
+            b.dir_next();
+        }
+        else
+        {
+            bool has_a = a.rd.next_entry(ea), has_b = b.rd.next_entry(eb);
+            while(has_a || has_b)
+            {
+                int n = !has_a ? 1 : (!has_b ? -1 : strcoll(ea.name.c_str(), eb.name.c_str()));
+                if(n < 0)
+                {
+                    cb(SNAPDIFF_REMOVED, a.dir.path + "/" + ea.name);
+                    has_a = a.rd.next_entry(ea);
+                }
+                else if(n > 0)
+                {
+                    cb(SNAPDIFF_ADDED, b.dir.path + "/" + eb.name);
+                    has_b = b.rd.next_entry(eb);
+                }
+                else
+                {
+                    if(entry_changed(ea, eb))
+                        cb(SNAPDIFF_CHANGED, b.dir.path + "/" + eb.name);
+                    has_a = a.rd.next_entry(ea);
+                    has_b = b.rd.next_entry(eb);
+                }
+            }
+            a.dir_next();
+            b.dir_next();
+        }
+    }
+
+    if(a.unordered || b.unordered)
+    {
+        err_msg = (a.unordered ? a.path : b.path) + " is not in snapshot order, take it again!!";
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+snapshot_reader::snapshot_reader(): fmt(SNAPSHOT_TEXT), in_dir(false), map(NULL), map_size(0), pos(0),
+                                    dir_off(0), dir_end(0), entries_left(0)
+{
+}
+
+snapshot_reader::~snapshot_reader()
+{
+    close();
+}
+
+void snapshot_reader::close()
+{
+    if(map)
+        munmap((void *) map, map_size);
+    map = NULL;
+    map_size = pos = dir_off = dir_end = 0;
+    entries_left = 0;
+    in_dir = false;
+    if(text.is_open())
+        text.close();
+}
+
+int snapshot_reader::open(const string &path, string &err_msg)
+{
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(FAILURE == fd)
+    {
+        err_msg = "Unable to open " + path + ": " + strerror(errno);
+        return FAILURE;
+    }
+
+    char magic[sizeof(snap_magic)];
+    ssize_t n = pread(fd, magic, sizeof(magic), 0);
+    if(n == sizeof(magic) && !memcmp(magic, snap_magic, sizeof(snap_magic)))
+    {
+        struct stat st;
+        void *m = MAP_FAILED;
+        if(SUCCESS == fstat(fd, &st) && (size_t) st.st_size >= sizeof(snap_header))
+            m = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if(m == MAP_FAILED)
+        {
+            err_msg = "Unable to read " + path;
+            return FAILURE;
+        }
+        madvise(m, st.st_size, MADV_SEQUENTIAL);
+
+        fmt = SNAPSHOT_BINARY;
+        map = (const char *) m;
+        map_size = st.st_size;
+        pos = dir_end = sizeof(snap_header);
+        return SUCCESS;
+    }
+    ::close(fd);
+
+    fmt = SNAPSHOT_TEXT;
+    text_buf.resize(1024 * 1024);
+    text.rdbuf()->pubsetbuf(text_buf.data(), text_buf.size());
+    text.open(path.c_str());
+    if(!text.is_open())
+    {
+        err_msg = "Unable to open " + path;
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+bool snapshot_reader::next_dir(snapshot_dir &dir)
+{
+    if(fmt == SNAPSHOT_BINARY)
+    {
+        pos = dir_off = dir_end;
+        entries_left = 0;
+        if(!map || pos + sizeof(snap_dir_rec) > map_size)
+            return false;
+
+        snap_dir_rec dr;
+        memcpy(&dr, map + pos, sizeof(dr));
+        size_t path_off = pos + sizeof(dr);
+        size_t entries_off = align8(path_off + dr.path_len);
+        if(entries_off > map_size || dr.entries_size > map_size - entries_off)
+            return false;       // truncated
+
+        dir.path.assign(map + path_off, dr.path_len);
+        dir.ino = dr.ino;
+        dir.mtime_sec = dr.mtime_sec;
+        dir.mtime_nsec = dr.mtime_nsec;
+        dir.n_entries = dr.n_entries;
+
+        pos = entries_off;
+        dir_end = entries_off + dr.entries_size;
+        entries_left = dr.n_entries;
+        return true;
+    }
+
+    /* the rest of the current directory, then blank lines up to a header */
+    while(in_dir && getline(text, line) && !line.empty());
+    in_dir = false;
+    while(getline(text, line))
+    {
+        if(line.empty())
+            continue;
+        if(line.back() != ':')
+            return false;       // not a snapshot
+
+        dir.path = line.substr(0, line.size() - 1);
+        dir.ino = 0;
+        dir.mtime_sec = 0;
+        dir.mtime_nsec = 0;
+        dir.n_entries = 0;
+        in_dir = true;
+        return true;
+    }
+    return false;
+}
+
+bool snapshot_reader::next_entry(snapshot_entry &entry)
+{
+    if(fmt == SNAPSHOT_BINARY)
+    {
+        if(!entries_left || pos + sizeof(snap_entry_rec) > dir_end)
+            return false;
+
+        snap_entry_rec er;
+        memcpy(&er, map + pos, sizeof(er));
+        size_t name_off = pos + sizeof(er);
+        if(name_off + er.name_len > dir_end)
+            return false;
+
+        entry.name.assign(map + name_off, er.name_len);
+        entry.type = er.type;
+        entry.size = er.size;
+        entry.mtime_sec = er.mtime_sec;
+        entry.mtime_nsec = er.mtime_nsec;
+        entry.ino = er.ino;
+
+        pos = align8(name_off + er.name_len);
+        --entries_left;
+        return true;
+    }
+
+    if(!in_dir || !getline(text, line) || line.empty())
+    {
+        in_dir = false;
+        return false;
+    }
+    entry.name = line;
+    entry.type = DT_UNKNOWN;
+    entry.size = 0;
+    entry.mtime_sec = 0;
+    entry.mtime_nsec = 0;
+    entry.ino = 0;
+    return true;
+}
+
+bool snapshot_reader::dir_read(size_t off, snapshot_dir &dir, vector<snapshot_entry> &entries) const
+{
+    if(!map || off < sizeof(snap_header) || off + sizeof(snap_dir_rec) > map_size)
+        return false;
+
+    snap_dir_rec dr;
+    memcpy(&dr, map + off, sizeof(dr));
+    size_t path_off = off + sizeof(dr);
+    size_t entries_off = align8(path_off + dr.path_len);
+    if(entries_off > map_size || dr.entries_size > map_size - entries_off)
+        return false;
+
+    dir.path.assign(map + path_off, dr.path_len);
+    dir.ino = dr.ino;
+    dir.mtime_sec = dr.mtime_sec;
+    dir.mtime_nsec = dr.mtime_nsec;
+    dir.n_entries = dr.n_entries;
+
+    size_t end = entries_off + dr.entries_size;
+    size_t p = entries_off;
+    entries.resize(dr.n_entries);
+    for(auto &entry : entries)
+    {
+        snap_entry_rec er;
+        if(p + sizeof(er) > end)
+            return false;
+        memcpy(&er, map + p, sizeof(er));
+        if(p + sizeof(er) + er.name_len > end)
+            return false;
+
+        entry.name.assign(map + p + sizeof(er), er.name_len);
+        entry.type = er.type;
+        entry.size = er.size;
+        entry.mtime_sec = er.mtime_sec;
+        entry.mtime_nsec = er.mtime_nsec;
+        entry.ino = er.ino;
+        p = align8(p + sizeof(er) + er.name_len);
+    }
+    return true;
+}
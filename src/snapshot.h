@@ -0,0 +1,114 @@
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <functional>
+#include <cstdint>
+
+#include "file_ops.h"
+
+#define SNAPSHOT_TEXT       0       // "./dir:" lines followed by the names, as always
+#define SNAPSHOT_BINARY     1       // length-prefixed records with size, mtime and inode
+
+#define SNAPSHOT_READ_AHEAD 64      // directories read in advance of the writer
+
+#define SNAPDIFF_ADDED      0
+#define SNAPDIFF_REMOVED    1
+#define SNAPDIFF_CHANGED    2       // type, size or mtime differ; binary snapshots only
+
+struct snapshot_dir
+{
+    std::string  path;          // "." for the snapshot folder, "./a/b" below it
+    uint64_t     ino;           // 0 in the text format
+    int64_t      mtime_sec;
+    uint32_t     mtime_nsec;
+    uint32_t     n_entries;     // 0 in the text format, where it is not known up front
+};
+
+struct snapshot_entry
+{
+    std::string  name;
+    uint8_t      type;          // DT_* of the entry, DT_UNKNOWN in the text format
+    uint64_t     size;
+    int64_t      mtime_sec;
+    uint32_t     mtime_nsec;
+    uint64_t     ino;
+};
+
+struct snapshot_stats
+{
+    uint64_t  n_dirs;
+    uint64_t  n_entries;
+    uint64_t  n_unreadable;     // directories that could not be read, written empty
+    uint64_t  n_reused;         // directories taken over from the previous snapshot
+};
+
+/* walks folder_path once and streams its snapshot into dump_path.
+ * Directories are written in pre-order, each one followed by its
+ * non-hidden entries sorted like alphasort; symbolic links are not
+ * followed.
+ * With a binary prev_path the snapshot is incremental: a directory whose
+ * inode and mtime match its record there is not read again, its entries
+ * are copied over.
+ * A ctl counts the entries written in files_done and can stop the walk,
+ * the partial dumpfile is then removed.
+ */
+int snapshot_write(const std::string &folder_path, const std::string &dump_path, int format,
+                   const std::string &prev_path, snapshot_stats &stats, std::string &err_msg,
+                   op_ctl *ctl = NULL);
+
+typedef std::function<void(int kind, const std::string &path)> snapdiff_cb;
+
+/* compares two snapshots by merge-joining them: directories by path, then
+ * the entries of a directory present in both by name. Only one entry of
+ * each is held at a time, so snapshots larger than memory are fine.
+ * cb gets the path of every difference relative to the snapshot folder.
+ */
+int snapshot_diff(const std::string &old_path, const std::string &new_path, snapdiff_cb cb,
+                  std::string &err_msg);
+
+/* sequential reader of a snapshot in either format, the binary one is
+ * memory-mapped. next_dir() moves to the next directory, skipping what is
+ * left of the current one; next_entry() returns its entries in order.
+ */
+class snapshot_reader
+{
+public:
+    snapshot_reader();
+    ~snapshot_reader();
+
+    int  open(const std::string &path, std::string &err_msg);
+    void close();
+    int  format() const { return fmt; }
+    bool next_dir(snapshot_dir &dir);
+    bool next_entry(snapshot_entry &entry);
+
+    /* binary format only: where the current directory starts, and random
+     * access to a directory by that offset. dir_read() leaves the reading
+     * position alone and may be used from several threads.
+     */
+    size_t dir_offset() const { return dir_off; }
+    bool   dir_read(size_t off, snapshot_dir &dir, std::vector<snapshot_entry> &entries) const;
+
+private:
+    snapshot_reader(const snapshot_reader&) = delete;
+    snapshot_reader& operator=(const snapshot_reader&) = delete;
+
+    int                fmt;
+    bool               in_dir;
+
+    const char        *map;
+    size_t             map_size;
+    size_t             pos;
+    size_t             dir_off;
+    size_t             dir_end;
+    uint32_t           entries_left;
+
+    std::ifstream      text;
+    std::vector<char>  text_buf;
+    std::string        line;
+};
+
+#endif
@@ -0,0 +1,147 @@
+#include "stats.h"
+#include "common.h"
+
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace std;
+
+struct stat_counter
+{
+    const char        *name;
+    bool               traced;      // per-entry paths would flood the trace
+    atomic<uint64_t>   calls;
+    atomic<uint64_t>   total_ns;
+    atomic<uint64_t>   max_ns;
+    atomic<uint64_t>   bytes;
+};
+
+static stat_counter counters[STAT_COUNT] =
+{
+    {"content_list_create", true},
+    {"dir_scan", true},
+    {"dir_scan.statx", false},
+    {"content_line_get", false},
+    {"name_cache.nss_lookup", false},
+    {"content_list_print", true},
+    {"render_frame_emit", true},
+    {"term_flush", true},
+    {"snapshot.dir_read", true},
+    {"file_copy", true},
+    {"dupes.full_hash", true},
+};
+
+struct trace_event
+{
+    stat_id   id;
+    uint64_t  start_ns;
+    uint64_t  dur_ns;
+    long      tid;
+};
+
+static mutex                trace_lock;
+static vector<trace_event>  trace_events;
+static uint64_t             trace_dropped;
+
+static bool trace_enabled()
+{
+    static const bool enabled = getenv(STATS_TRACE_ENV) && getenv(STATS_TRACE_ENV)[0];
+    return enabled;
+}
+
+static uint64_t ns_get(const struct timespec &ts)
+{
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static long tid_get()
+{
+    static thread_local long tid = syscall(SYS_gettid);
+    return tid;
+}
+
+stat_scope::stat_scope(stat_id id): id(id), bytes(0)
+{
+    clock_gettime(CLOCK_MONOTONIC, &start);
+}
+
+stat_scope::~stat_scope()
+{
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    uint64_t start_ns = ns_get(start), dur_ns = ns_get(end) - start_ns;
+
+    stat_counter &c = counters[id];
+    c.calls.fetch_add(1, memory_order_relaxed);
+    c.total_ns.fetch_add(dur_ns, memory_order_relaxed);
+    if(bytes)
+        c.bytes.fetch_add(bytes, memory_order_relaxed);
+    uint64_t max_ns = c.max_ns.load(memory_order_relaxed);
+    while(dur_ns > max_ns && !c.max_ns.compare_exchange_weak(max_ns, dur_ns, memory_order_relaxed));
+
+    if(c.traced && trace_enabled())
+    {
+        lock_guard<mutex> lk(trace_lock);
+        if(trace_events.size() < STATS_TRACE_MAX_EVENTS)
+            trace_events.pb({id, start_ns, dur_ns, tid_get()});
+        else
+            ++trace_dropped;
+    }
+}
+
+void stats_get(vector<stat_snapshot> &snaps)
+{
+    snaps.clear();
+    for(auto &c : counters)
+    {
+        snaps.pb({c.name, c.calls.load(memory_order_relaxed), c.total_ns.load(memory_order_relaxed),
+                  c.max_ns.load(memory_order_relaxed), c.bytes.load(memory_order_relaxed)});
+    }
+}
+
+void stats_reset()
+{
+    for(auto &c : counters)
+        c.calls = c.total_ns = c.max_ns = c.bytes = 0;
+}
+
+/* writes the recorded spans as complete ("X") events of the Chrome trace
+ * format, loadable in chrome://tracing or Perfetto
+ */
+int stats_trace_write(string &err_msg)
+{
+    if(!trace_enabled())
+        return SUCCESS;
+
+    string trace_path = getenv(STATS_TRACE_ENV);
+    ofstream out(trace_path.c_str(), ios::out | ios::trunc);
+
+    lock_guard<mutex> lk(trace_lock);
+    uint64_t origin = trace_events.empty() ? 0 : trace_events[0].start_ns;
+    for(auto &ev : trace_events)
+        origin = min(origin, ev.start_ns);
+
+    out << fixed << setprecision(3);      // microseconds down to the ns, whatever the length of the session
+    out << "{\"traceEvents\":[";
+    long pid = getpid();
+    for(size_t i = 0; i < trace_events.size(); ++i)
+    {
+        const trace_event &ev = trace_events[i];
+        out << (i ? ",\n" : "\n") << "{\"name\":\"" << counters[ev.id].name << "\",\"ph\":\"X\",\"ts\":"
+            << (ev.start_ns - origin) / 1000.0 << ",\"dur\":" << ev.dur_ns / 1000.0
+            << ",\"pid\":" << pid << ",\"tid\":" << ev.tid << "}";
+    }
+    out << "\n],\"otherData\":{\"dropped_events\":" << trace_dropped << "}}\n";
+    out.close();
+
+    if(out.fail())
+    {
+        err_msg = "Unable to write the trace to " + trace_path;
+        return FAILURE;
+    }
+    return SUCCESS;
+}
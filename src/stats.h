@@ -0,0 +1,64 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <time.h>
+
+/* the instrumented hot paths */
+enum stat_id
+{
+    STAT_CONTENT_LIST_CREATE,
+    STAT_DIR_SCAN,
+    STAT_ENTRY_STAT,
+    STAT_CONTENT_LINE_GET,
+    STAT_NAME_LOOKUP,
+    STAT_CONTENT_LIST_PRINT,
+    STAT_FRAME_EMIT,
+    STAT_TERM_FLUSH,
+    STAT_SNAPSHOT_DIR,
+    STAT_FILE_COPY,
+    STAT_DUPES_HASH,
+    STAT_COUNT
+};
+
+#define STATS_TRACE_ENV         "BHAVI_TRACE"       // file the Chrome trace is written to on exit
+#define STATS_TRACE_MAX_EVENTS  (1 << 20)           // events kept, later ones are dropped
+
+struct stat_snapshot
+{
+    std::string  name;
+    uint64_t     calls;
+    uint64_t     total_ns;
+    uint64_t     max_ns;
+    uint64_t     bytes;
+};
+
+/* process-wide counters and timers, cheap enough for per-entry paths and
+ * safe to use from any thread. With $BHAVI_TRACE set, every timed span of
+ * the coarse paths is also recorded and written out as Chrome trace JSON
+ * by stats_trace_write().
+ */
+class stat_scope
+{
+public:
+    explicit stat_scope(stat_id id);
+    ~stat_scope();
+
+    void bytes_add(uint64_t n) { bytes += n; }
+
+private:
+    stat_scope(const stat_scope&) = delete;
+    stat_scope& operator=(const stat_scope&) = delete;
+
+    stat_id          id;
+    struct timespec  start;
+    uint64_t         bytes;
+};
+
+void stats_get(std::vector<stat_snapshot> &snaps);
+void stats_reset();
+int  stats_trace_write(std::string &err_msg);
+
+#endif
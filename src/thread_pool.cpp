@@ -0,0 +1,154 @@
+#include "thread_pool.h"
+
+using namespace std;
+
+/* index of the worker running on this thread, -1 for non-pool threads */
+static thread_local int        worker_idx = -1;
+static thread_local work_pool *worker_pool = NULL;
+static thread_local work_pool *bound_pool = NULL;
+
+work_pool::work_pool(unsigned int n_workers): next_queue(0), queued(0), stop(false)
+{
+    if(!n_workers)
+        n_workers = thread::hardware_concurrency();
+    if(!n_workers)
+        n_workers = 1;
+
+    for(unsigned int i = 0; i < n_workers; ++i)
+        queues.emplace_back(new worker_queue);
+    for(unsigned int i = 0; i < n_workers; ++i)
+        workers.emplace_back(&work_pool::worker_run, this, i);
+}
+
+work_pool::~work_pool()
+{
+    {
+        lock_guard<mutex> lk(idle_lock);
+        stop = true;
+    }
+    idle_cv.notify_all();
+    for(auto &t : workers)
+        t.join();
+}
+
+void work_pool::submit(work_group &grp, task t)
+{
+    ++grp.pending;
+
+    unsigned int q;
+    if(worker_pool == this)
+        q = worker_idx;
+    else
+        q = next_queue++ % queues.size();
+
+    {
+        lock_guard<mutex> lk(queues[q]->lock);
+        queues[q]->tasks.push_back({move(t), &grp});
+    }
+    {
+        lock_guard<mutex> lk(idle_lock);
+        ++queued;
+    }
+    idle_cv.notify_one();
+}
+
+/* own deque is used LIFO (depth first, cache warm), others are robbed FIFO */
+bool work_pool::task_get(int self, queued_task &qt)
+{
+    if(self >= 0)
+    {
+        worker_queue &own = *queues[self];
+        lock_guard<mutex> lk(own.lock);
+        if(!own.tasks.empty())
+        {
+            qt = move(own.tasks.back());
+            own.tasks.pop_back();
+            --queued;
+            return true;
+        }
+    }
+
+    unsigned int n = queues.size();
+    unsigned int start = (self >= 0) ? self + 1 : next_queue.load();
+    for(unsigned int i = 0; i < n; ++i)
+    {
+        worker_queue &victim = *queues[(start + i) % n];
+        lock_guard<mutex> lk(victim.lock);
+        if(!victim.tasks.empty())
+        {
+            qt = move(victim.tasks.front());
+            victim.tasks.pop_front();
+            --queued;
+            return true;
+        }
+    }
+    return false;
+}
+
+void work_pool::task_run(queued_task &qt)
+{
+    qt.fn();
+    qt.fn = nullptr;
+    if(0 == --qt.grp->pending)
+    {
+        lock_guard<mutex> lk(idle_lock);
+        done_cv.notify_all();
+    }
+}
+
+void work_pool::worker_run(int self)
+{
+    worker_idx = self;
+    worker_pool = this;
+
+    while(1)
+    {
+        queued_task qt;
+        if(task_get(self, qt))
+        {
+            task_run(qt);
+            continue;
+        }
+
+        unique_lock<mutex> lk(idle_lock);
+        idle_cv.wait(lk, [this] { return stop || queued > 0; });
+        if(stop)
+            break;
+    }
+}
+
+/* blocks until every task of the group has run; the calling thread helps
+ * with queued work meanwhile, so waiting from inside a task cannot deadlock
+ */
+void work_pool::wait(work_group &grp)
+{
+    int self = (worker_pool == this) ? worker_idx : -1;
+    while(grp.pending > 0)
+    {
+        queued_task qt;
+        if(task_get(self, qt))
+        {
+            task_run(qt);
+            continue;
+        }
+
+        unique_lock<mutex> lk(idle_lock);
+        done_cv.wait_for(lk, chrono::milliseconds(1), [&grp] { return grp.pending == 0; });
+    }
+}
+
+/* process-wide pool, sized to the number of cores */
+work_pool& pool_get()
+{
+    static work_pool pool;
+    if(worker_pool)
+        return *worker_pool;
+    if(bound_pool)
+        return *bound_pool;
+    return pool;
+}
+
+void pool_bind(work_pool *pool)
+{
+    bound_pool = pool;
+}
@@ -0,0 +1,70 @@
+#ifndef _THREAD_POOL_H_
+#define _THREAD_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* a set of tasks that can be waited upon together */
+struct work_group
+{
+    std::atomic<long> pending;
+
+    work_group(): pending(0) {}
+};
+
+/* work-stealing pool: every worker owns a deque, pops its own work from the
+ * back and steals from the front of the other deques when it runs dry.
+ * Tasks submitted from inside a worker go to that worker's own deque.
+ */
+class work_pool
+{
+public:
+    typedef std::function<void()> task;
+
+    explicit work_pool(unsigned int n_workers = 0);
+    ~work_pool();
+
+    void submit(work_group &grp, task t);
+    void wait(work_group &grp);
+    unsigned int size() const { return workers.size(); }
+
+private:
+    struct queued_task
+    {
+        task        fn;
+        work_group *grp;
+    };
+
+    struct worker_queue
+    {
+        std::mutex               lock;
+        std::deque<queued_task>  tasks;
+    };
+
+    bool task_get(int self, queued_task &qt);
+    void task_run(queued_task &qt);
+    void worker_run(int self);
+
+    std::vector<std::thread>                    workers;
+    std::vector<std::unique_ptr<worker_queue>>  queues;
+    std::mutex                                  idle_lock;
+    std::condition_variable                     idle_cv;
+    std::condition_variable                     done_cv;
+    std::atomic<unsigned int>                   next_queue;
+    std::atomic<long>                           queued;
+    bool                                        stop;
+};
+
+/* the pool tasks started from this thread go to: the pool the thread works
+ * for, else the one bound with pool_bind(), else the process-wide pool
+ */
+work_pool& pool_get();
+void       pool_bind(work_pool *pool);
+
+#endif